@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "features.h"
+#include "io.h"
+#include "kmeans.h"
+#include "model.h"
+#include "strokes.h"
+#include "svg.h"
+#include "svm.h"
+#include "synth.h"
+#include "types.h"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+// Print the throughput and latency percentiles of the calls of a stage as a
+// tab-separated line.  Latencies are in microseconds.
+void report(const char *stage, unsigned int threads,
+  std::vector< double > &latencies, double seconds) {
+  std::sort(latencies.begin(), latencies.end());
+
+  const std::size_t n = latencies.size();
+  const auto percentile = [&](double p) {
+    const std::size_t rank = static_cast< std::size_t >(std::ceil(p * n));
+    return latencies[std::min(std::max(rank, std::size_t(1)), n) - 1];
+  };
+
+  double sum = 0;
+  for (const double x : latencies)
+    sum += x;
+
+  std::cout << stage << '\t' << threads << '\t' << n << '\t'
+    << n / seconds << '\t' << sum / n << '\t' << percentile(.5) << '\t'
+    << percentile(.9) << '\t' << percentile(.99) << '\t' << latencies.back()
+    << std::endl;
+}
+
+// Time `count' calls of f(i), spread over a number of threads.  If f is
+// parallel itself, the calls are made one at a time and f uses the threads.
+template< class F >
+void run_stage(const char *stage, unsigned int threads, std::size_t count,
+  bool parallel, F f) {
+  std::vector< double > latencies(count);
+
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+
+  const auto start = clock_type::now();
+  #pragma omp parallel for schedule(dynamic) if(!parallel)
+  for (long i = 0; i < static_cast< long >(count); ++i) {
+    const auto call_start = clock_type::now();
+    f(i);
+    latencies[i] = std::chrono::duration< double, std::micro >(
+      clock_type::now() - call_start).count();
+  }
+  const double seconds = std::chrono::duration< double >(
+    clock_type::now() - start).count();
+
+  report(stage, threads, latencies, seconds);
+}
+
+// Parse a comma-separated list of thread counts.
+bool parse_threads(const char *s, std::vector< unsigned int > &threads) {
+  threads.clear();
+  std::istringstream ss(s);
+  for (std::string item; std::getline(ss, item, ',');) {
+    std::istringstream is(item);
+    unsigned int n;
+    if (!(is >> n) || !is.eof() || !n)
+      return false;
+    threads.push_back(n);
+  }
+  return !threads.empty();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  // Process the command-line arguments.
+  std::size_t sketch_count = 64;
+  unsigned int category_count = 8;
+  unsigned int repeats = 4;
+  std::uint32_t seed = 1;
+  std::vector< unsigned int > thread_counts(1, 1);
+  if (std::thread::hardware_concurrency() > 1)
+    thread_counts.push_back(std::thread::hardware_concurrency());
+
+  {
+    int i;
+    for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h")) {
+        goto usage;
+      }
+      else if (!strcmp(argv[i], "-n")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> sketch_count) || !sketch_count)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-k")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> category_count) || category_count < 2)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-r")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> repeats) || !repeats)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-s")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> seed))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-t")) {
+        if (!parse_threads(argv[++i], thread_counts))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--tent")) {
+        if (!set_tent_engine(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--dense")) {
+        feature_settings().sparse = false;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else {
+        break;
+      }
+    }
+
+    if (i != argc)
+      goto usage;
+
+    if (sketch_count < category_count)
+      goto usage;
+  }
+
+  {
+    // Generate the synthetic sketches.  Progress goes to standard error, so
+    // standard output holds only the results.
+    std::cerr << "Generating " << sketch_count << " sketches in "
+      << category_count << " categories...\n";
+    const sketch_synth synth(seed);
+    std::vector< strokes_type > sketches(sketch_count);
+    std::vector< std::string > svgs(sketch_count);
+    std::vector< int > labels(sketch_count);
+    for (std::size_t i = 0; i < sketch_count; ++i) {
+      labels[i] = i % category_count + 1;
+      synth.generate(labels[i] - 1, i / category_count, sketches[i]);
+      std::ostringstream ss;
+      write_svg(ss, sketches[i]);
+      svgs[i] = ss.str();
+    }
+
+    // Compute the input of each stage up front, so each stage is timed in
+    // isolation.  This also plans the FFT before timing.
+    std::cerr << "Extracting features...\n";
+    std::vector< image_type > images(sketch_count);
+    std::vector< std::vector< feature_desc_type > > descs(sketch_count);
+    std::vector< std::vector< bool > > empty(sketch_count);
+    for (std::size_t i = 0; i < sketch_count; ++i) {
+      sketch_workspace &ws = sketch_workspace::local();
+      load_svg(svgs[i].data(), svgs[i].size(), images[i]);
+      extract_descriptors(images[i], ws);
+      descs[i] = ws.descs;
+      empty[i] = ws.empty;
+    }
+
+    // Use random descriptors as the vocabulary, since its quality does not
+    // affect the timings.
+    std::vector< feature_desc_type > samples;
+    for (const auto &ds : descs)
+      samples.insert(samples.end(), ds.begin(), ds.end());
+
+    vocab_type vocab;
+    {
+      std::mt19937 g(seed);
+      for (long k = 0; k < feature_hist_type::NR; ++k)
+        vocab.push_back(samples[g() % samples.size()]);
+    }
+
+    std::cerr << "Training classifiers...\n";
+    std::vector< feature_hist_type > hists(sketch_count);
+    for (std::size_t i = 0; i < sketch_count; ++i)
+      feature_hist(descs[i], empty[i], vocab, hists[i]);
+
+    trainer_type rbf_trainer;
+    rbf_trainer.set_kernel(kernel_type(17.8));
+    rbf_trainer.set_c(3.2);
+    const ova_df_type ova_df(ova_trainer_type(rbf_trainer).train(hists,
+      labels));
+    const ovo_df_type ovo_df(ovo_trainer_type(rbf_trainer).train(hists,
+      labels));
+
+    std::string vocab_data, ova_data;
+    {
+      std::ostringstream ss;
+      serialize2(vocab, ss);
+      vocab_data = ss.str();
+    }
+    {
+      std::ostringstream ss;
+      serialize2(ova_df, ss);
+      ova_data = ss.str();
+    }
+
+    // Time each stage at each thread count.
+    std::cout << "stage\tthreads\tcalls\tcalls_per_s\tmean_us\tp50_us"
+      "\tp90_us\tp99_us\tmax_us" << std::endl;
+
+    const std::size_t calls = sketch_count * repeats;
+    for (const unsigned int threads : thread_counts) {
+      run_stage("load_svg", threads, calls, false, [&](std::size_t i) {
+        image_type &image =
+          sketch_workspace::local().buffers< image_type::NR >().image;
+        const std::string &svg = svgs[i % sketch_count];
+        load_svg(svg.data(), svg.size(), image);
+      });
+
+      run_stage("rasterize_strokes", threads, calls, false,
+        [&](std::size_t i) {
+          image_type &image =
+            sketch_workspace::local().buffers< image_type::NR >().image;
+          rasterize_strokes(sketches[i % sketch_count], image);
+        });
+
+      run_stage("extract_descriptors", threads, calls, false,
+        [&](std::size_t i) {
+          extract_descriptors(images[i % sketch_count],
+            sketch_workspace::local());
+        });
+
+      run_stage("feature_hist", threads, calls, false, [&](std::size_t i) {
+        const std::size_t k = i % sketch_count;
+        feature_hist(descs[k], empty[k], vocab,
+          sketch_workspace::local().hist< feature_hist_type::NR >());
+      });
+
+      run_stage("ova_predict", threads, calls, false, [&](std::size_t i) {
+        ova_df(hists[i % sketch_count]);
+      });
+
+      run_stage("ovo_predict", threads, calls, false, [&](std::size_t i) {
+        ovo_df(hists[i % sketch_count]);
+      });
+
+      run_stage("kmeans_iteration", threads, repeats, true,
+        [&](std::size_t) {
+          vocab_type centers = vocab;
+          kmeans< float >(samples, centers, 1);
+        });
+
+      run_stage("serialize_vocab", threads, calls, false, [&](std::size_t) {
+        std::ostringstream ss;
+        serialize2(vocab, ss);
+      });
+
+      run_stage("deserialize_vocab", threads, calls, false,
+        [&](std::size_t) {
+          std::istringstream ss(vocab_data);
+          vocab_type v;
+          deserialize2(v, ss);
+        });
+
+      run_stage("serialize_ova", threads, calls, false, [&](std::size_t) {
+        std::ostringstream ss;
+        serialize2(ova_df, ss);
+      });
+
+      run_stage("deserialize_ova", threads, calls, false, [&](std::size_t) {
+        std::istringstream ss(ova_data);
+        ova_df_type df;
+        deserialize2(df, ss);
+      });
+
+      run_stage("pipeline", threads, calls, false, [&](std::size_t i) {
+        sketch_workspace &ws = sketch_workspace::local();
+        image_type &image = ws.buffers< image_type::NR >().image;
+        feature_hist_type &hist = ws.hist< feature_hist_type::NR >();
+        const std::string &svg = svgs[i % sketch_count];
+        load_svg(svg.data(), svg.size(), image);
+        extract_descriptors(image, ws);
+        feature_hist(ws.descs, ws.empty, vocab, hist);
+        ova_df(hist);
+      });
+    }
+  }
+
+  return 0;
+
+usage:
+  std::cerr << "Usage: " << argv[0] << " [-n sketch-count]"
+    " [-k category-count] [-r repeats] [-s seed] [-t thread-counts]"
+    " [--tent engine] [--dense]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]\n";
+  return 1;
+}
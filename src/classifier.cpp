@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "classifier.h"
+#include "classifier_extract.h"
+#include "features.h"
+#include "input.h"
+#include "model.h"
+#include "stats.h"
+#include "strokes.h"
+#include "svg.h"
+#include "svm.h"
+#include "types.h"
+
+namespace {
+
+// A classifier for a vocabulary of any size
+struct model {
+  virtual ~model() {
+  }
+
+  // Classify a sketch from its descriptors, filling in the category and up
+  // to top_count of the best scores.
+  virtual void classify(sketch_workspace &ws, std::size_t top_count,
+    prediction &pred) const = 0;
+};
+
+// A classifier for a vocabulary of V words
+template< long V >
+struct sized_model : model {
+  typedef classifier_types< V > types;
+
+  sized_model(const vocab_type &vocab_, bool ova_) : vocab(vocab_),
+    ova(ova_) {
+  }
+
+  virtual void classify(sketch_workspace &ws, std::size_t top_count,
+    prediction &pred) const {
+    typedef std::vector< std::pair< int, float > > scores_type;
+
+    typename types::hist_type &hist = ws.hist< V >();
+    feature_hist(ws.descs, ws.empty, vocab, hist);
+
+    const stage_timer t(stat_predict);
+    const bool intra = feature_settings().intra_sketch;
+    pred.scores.clear();
+    if (!top_count) {
+      pred.category = ova ?
+        predict(df.template get< typename types::ova_df_type >(), hist,
+          intra) :
+        predict(df.template get< typename types::ovo_df_type >(), hist,
+          intra);
+      return;
+    }
+
+    scores_type &scores = ws.scores;
+    if (ova) {
+      decision_scores(df.template get< typename types::ova_df_type >(), hist,
+        scores, intra);
+    }
+    else {
+      decision_scores(df.template get< typename types::ovo_df_type >(), hist,
+        scores, intra);
+    }
+
+    if (scores.empty())
+      throw std::runtime_error("empty classifier");
+
+    pred.category = scores[0].first;
+    pred.scores.assign(scores.begin(), scores.begin() +
+      std::min(static_cast< typename scores_type::size_type >(top_count),
+      scores.size()));
+  }
+
+  const vocab_type &vocab;
+  bool ova;
+  typename types::df_type df;
+};
+
+// Load a classifier for a vocabulary of V words.
+struct model_loader {
+  const vocab_type &vocab;
+  model_sizes sizes;
+  const char *cats_path;
+  bool ova;
+
+  template< long V >
+  std::unique_ptr< const model > operator()(size_tag< V >) const {
+    std::unique_ptr< sized_model< V > > m(new sized_model< V >(vocab, ova));
+    load_classifier< V >(cats_path, sizes, ova, m->df);
+    return std::unique_ptr< const model >(m.release());
+  }
+};
+
+// A callable that rasterizes an SVG image in memory into an image of any
+// size
+struct svg_loader {
+  template< class T, long N >
+  void operator()(dlib::matrix< T, N, N > &image) const {
+    load_svg(data, size, image);
+  }
+
+  const char *data;
+  std::size_t size;
+};
+
+// A callable that loads an SVG or stroke file into an image of any size
+struct file_loader {
+  template< class T, long N >
+  void operator()(dlib::matrix< T, N, N > &image) const {
+    if (is_strokes_path(path))
+      load_strokes(path.c_str(), image);
+    else
+      load_svg(path.c_str(), image);
+  }
+
+  const std::string &path;
+};
+
+}
+
+struct classifier::state {
+  state(const char *vocab_path, const char *map_path, const char *cats_path,
+    bool ova) {
+    sizes = load_vocab(vocab_path, vocab);
+    check_model_engine(sizes);
+    load_category_labels(map_path, cat_map);
+
+    const model_loader loader = { vocab, sizes, cats_path, ova };
+    m = dispatch_word_count(sizes.word_count, loader);
+  }
+
+  vocab_type vocab;
+  model_sizes sizes;
+  std::map< int, std::string > cat_map;
+  std::unique_ptr< const model > m;
+};
+
+classifier::classifier(const char *vocab_path, const char *map_path,
+  const char *cats_path, bool ova) :
+  s(new state(vocab_path, map_path, cats_path, ova)) {
+}
+
+classifier::~classifier() {
+}
+
+const model_sizes &classifier::sizes() const {
+  return s->sizes;
+}
+
+long classifier::image_size() const {
+  return s->sizes.image_size;
+}
+
+long classifier::word_count() const {
+  return s->sizes.word_count;
+}
+
+const std::map< int, std::string > &classifier::categories() const {
+  return s->cat_map;
+}
+
+const std::string &classifier::label(int cat) const {
+  static const std::string unknown = "?";
+  const auto it = s->cat_map.find(cat);
+  return (it != s->cat_map.end()) ? it->second : unknown;
+}
+
+prediction classifier::classify(sketch_workspace &ws,
+  std::size_t top_count) const {
+  prediction pred;
+  s->m->classify(ws, top_count, pred);
+  pred.label = label(pred.category);
+  return pred;
+}
+
+prediction classifier::classify_svg(const char *data, std::size_t size,
+  std::size_t top_count) const {
+  const svg_loader load = { data, size };
+  return classify_loaded(*this, load, top_count);
+}
+
+prediction classifier::classify_strokes(const strokes_type &strokes,
+  std::size_t top_count) const {
+  return classify_loaded(*this, strokes_loader(strokes), top_count);
+}
+
+prediction classifier::classify_file(const std::string &path,
+  std::size_t top_count) const {
+  const file_loader load = { path };
+  return classify_loaded(*this, load, top_count);
+}
+
+void classifier::classify_batch(const std::vector< strokes_type > &sketches,
+  std::vector< prediction > &preds, std::size_t top_count) const {
+  std::vector< strokes_loader > loads;
+  loads.reserve(sketches.size());
+  for (const auto &strokes : sketches)
+    loads.push_back(strokes_loader(strokes));
+  classify_loaded_batch(*this, loads, preds, top_count);
+}
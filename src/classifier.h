@@ -0,0 +1,87 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stroke_types.h"
+
+// Defined in model.h, which is not installed
+struct model_sizes;
+class sketch_workspace;
+
+// The predicted category of a sketch
+struct prediction {
+  int category;
+  std::string label;
+
+  // The best categories and their scores, in decreasing order of score.
+  // Scores are the outputs of the binary decision functions for one-vs-all
+  // classifiers and vote counts for one-vs-one classifiers.
+  std::vector< std::pair< int, float > > scores;
+};
+
+// A trained sketch classifier
+//
+// The vocabulary, category map and classifier are loaded once, and the image
+// and vocabulary sizes recorded in the files select the instantiation of the
+// feature extractor and classifier to use.  All classification functions
+// are const and use per-thread buffers, so one classifier may be shared by
+// any number of threads.
+class classifier {
+public:
+  classifier(const char *vocab_path, const char *map_path,
+    const char *cats_path, bool ova = true);
+  ~classifier();
+
+  classifier(const classifier &) = delete;
+  classifier &operator=(const classifier &) = delete;
+
+  const model_sizes &sizes() const;
+
+  // The image size sketches are rasterized at and the vocabulary size
+  long image_size() const;
+  long word_count() const;
+
+  const std::map< int, std::string > &categories() const;
+
+  // Return the label of a category, or "?" if it is not in the map.
+  const std::string &label(int cat) const;
+
+  // Classify a sketch whose descriptors are in a workspace, returning up to
+  // top_count of the best scores.  The histogram is computed in the
+  // workspace too.  See classifier_extract.h for extracting the
+  // descriptors.
+  prediction classify(sketch_workspace &ws,
+    std::size_t top_count = 0) const;
+
+  // Classify an SVG image in memory.
+  prediction classify_svg(const char *data, std::size_t size,
+    std::size_t top_count = 0) const;
+
+  // Classify a sketch given as strokes.
+  prediction classify_strokes(const strokes_type &strokes,
+    std::size_t top_count = 0) const;
+
+  // Classify an SVG or stroke file.
+  prediction classify_file(const std::string &path,
+    std::size_t top_count = 0) const;
+
+  // Classify a batch of sketches in parallel, storing the predictions in
+  // input order.
+  void classify_batch(const std::vector< strokes_type > &sketches,
+    std::vector< prediction > &preds, std::size_t top_count = 0) const;
+
+  // The vocabulary, sizes, category map and sized classifier, defined by
+  // the implementation
+  struct state;
+
+private:
+  std::unique_ptr< const state > s;
+};
+
+#endif
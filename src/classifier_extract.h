@@ -0,0 +1,32 @@
+#ifndef CLASSIFIER_EXTRACT_H
+#define CLASSIFIER_EXTRACT_H
+
+#include <cstddef>
+#include <vector>
+
+#include "classifier.h"
+#include "model.h"
+
+// Classify a sketch rasterized by a callable, as for extract_sized, using
+// the calling thread's workspace.
+template< class Load >
+prediction classify_loaded(const classifier &c, const Load &load,
+  std::size_t top_count = 0) {
+  sketch_workspace &ws = sketch_workspace::local();
+  extract_sized(c.sizes(), load, ws);
+  return c.classify(ws, top_count);
+}
+
+// Classify a batch of sketches rasterized by callables in parallel, storing
+// the predictions in input order.
+template< class Load >
+void classify_loaded_batch(const classifier &c,
+  const std::vector< Load > &loads, std::vector< prediction > &preds,
+  std::size_t top_count = 0) {
+  preds.resize(loads.size());
+  #pragma omp parallel for schedule(dynamic)
+  for (long i = 0; i < static_cast< long >(loads.size()); ++i)
+    preds[i] = classify_loaded(c, loads[i], top_count);
+}
+
+#endif
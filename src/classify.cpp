@@ -1,17 +1,19 @@
 #include <cassert>
+#include <cstddef>
 #include <cstring>
-#include <fstream>
 #include <iostream>
-#include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "classifier.h"
+#include "classifier_extract.h"
 #include "features.h"
-#include "io.h"
-#include "svg.h"
-#include "svm.h"
-#include "types.h"
+#include "input.h"
+#include "sketch_pipeline.h"
+#include "stats.h"
+#include "stream.h"
 
 int main(int argc, char *argv[]) {
   // Process the command-line arguments.
@@ -19,6 +21,15 @@ int main(int argc, char *argv[]) {
   const char *map_path = "map_id_label.txt";
   const char *cats_path = "cats.out";
   bool ova = true;
+  bool stream = false;
+  std::size_t window = 64;
+  const char *zip_path = nullptr;
+  const char *pack_path = nullptr;
+  const char *fold_id = nullptr;
+  const char *category = nullptr;
+  double stats_interval = 0;
+  bool use_pipeline = false;
+  pipeline_options pipe = default_pipeline_options();
 
   {
     int i;
@@ -46,6 +57,65 @@ int main(int argc, char *argv[]) {
           goto err;
         }
       }
+      else if (!strcmp(argv[i], "--stream")) {
+        stream = true;
+      }
+      else if (!strcmp(argv[i], "--window")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> window) || !window)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-z")) {
+        zip_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-p")) {
+        pack_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--fold")) {
+        fold_id = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--category")) {
+        category = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--tent")) {
+        if (!set_tent_engine(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--dense")) {
+        feature_settings().sparse = false;
+      }
+      else if (!strcmp(argv[i], "--intra")) {
+        feature_settings().intra_sketch = true;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--pipeline")) {
+        if (!parse_pipeline_threads(argv[++i], pipe))
+          goto usage;
+        use_pipeline = true;
+      }
+      else if (!strcmp(argv[i], "--queue")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> pipe.capacity) || !pipe.capacity)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--stats")) {
+        stats_enabled() = true;
+      }
+      else if (!strcmp(argv[i], "--stats-interval")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> stats_interval) || stats_interval <= 0)
+          goto usage;
+        stats_enabled() = true;
+      }
       else {
         break;
       }
@@ -57,76 +127,82 @@ int main(int argc, char *argv[]) {
     if (i != argc)
       goto usage;
 
+    if ((fold_id || category) && !zip_path && !pack_path)
+      goto usage;
+
+    if (zip_path && pack_path)
+      goto usage;
+
+    if (stream && (fold_id || category || pack_path))
+      goto usage;
+
+    if (stream && use_pipeline)
+      goto usage;
+
     if (!vocab_path || !map_path || !cats_path)
       goto usage;
   }
 
   {
-    // Load the vocabulary.
-    std::cout << "Loading vocabulary...\n";
-    vocab_type vocab;
-    {
-      std::ifstream fs(vocab_path, std::ios::binary);
-      deserialize2(vocab, fs);
-    }
+    const stats_reporter reporter(std::cerr, stats_interval);
 
-    // Load the category map.
-    std::cout << "Loading category map...\n";
-    std::map< int, std::string > cat_map;
-    {
-      std::ifstream fs(map_path);
-      for (std::string line; std::getline(fs, line);) {
-        std::istringstream ss(line);
-        int i;
-        std::string label;
-        ss >> i;
-        ss.get(); // ','
-        std::getline(ss, label);
-        cat_map[i] = label;
-      }
-    }
-
-    // Load the category classifier.
+    // Load the vocabulary, category map and classifier.
     std::cout << "Loading classifier...\n";
-    df_type df;
-    {
-      std::ifstream fs(cats_path, std::ios::binary);
-      if (ova)
-        deserialize2(df.get< ova_df_type >(), fs);
-      else
-        deserialize2(df.get< ovo_df_type >(), fs);
+    const classifier c(vocab_path, map_path, cats_path, ova);
+
+    // Find the input files.
+    sketch_source sketches;
+    if (zip_path)
+      sketches.open_archive(zip_path);
+    if (pack_path)
+      sketches.open_pack(pack_path, c.image_size());
+    if (fold_id || category || pack_path)
+      sketches.select(fold_id, category);
+    else if (!stream)
+      sketches.read_paths(std::cin);
+
+    if (stream) {
+      // Classify each path as soon as it is read, writing the results in
+      // input order.
+      ordered_stream< std::string, int > paths(
+        std::thread::hardware_concurrency(), window);
+      paths.run(
+        [](std::string &path) {
+          return static_cast< bool >(std::getline(std::cin, path));
+        },
+        [&](const std::string &path, int &cat) {
+          cat = classify_loaded(c, make_loader(sketches, path)).category;
+          assert(cat);
+        },
+        [&](const std::string &path, const int &cat) {
+          std::cout << path << ' ' << c.label(cat) << std::endl;
+        });
     }
-
-    // Extract features for all input files.
-    std::vector< std::string > paths;
-    std::string path;
-    while (std::getline(std::cin, path))
-      paths.push_back(path);
-
-    #pragma omp parallel for schedule(dynamic)
-    for (typename std::vector< std::string >::size_type i = 0;
-      i < paths.size(); ++i) {
-      const std::string &path = paths[i];
-
-      // Extract the features.
-      image_type image;
-      load_svg(path.c_str(), image);
-      image = 1. - image;
-
-      std::vector< feature_desc_type > descs;
-      extract_descriptors(image, descs);
-
-      feature_hist_type hist;
-      feature_hist(descs, vocab, hist);
-
-      const int cat = ova ? df.get< ova_df_type >()(hist) :
-        df.get< ovo_df_type >()(hist);
-
-      assert(cat);
-
-      #pragma omp critical
-      {
-        std::cout << path << ' ' << cat_map[cat] << '\n';
+    else if (use_pipeline) {
+      // Classify on a pipeline, writing the results in input order.
+      std::vector< prediction > preds(sketches.size());
+      run_sketch_pipeline(sketches, c.sizes(), pipe,
+        [&](sketch_job &job) {
+          preds[job.index] = c.classify(job.ws);
+          assert(preds[job.index].category);
+        },
+        [&](sketch_job &job) {
+          std::cout << sketches.path(job.index) << ' '
+            << preds[job.index].label << '\n';
+        });
+    }
+    else {
+      #pragma omp parallel for schedule(dynamic)
+      for (typename sketch_source::size_type i = 0; i < sketches.size();
+        ++i) {
+        const std::string &path = sketches.path(i);
+        const prediction pred = classify_loaded(c, make_loader(sketches, i));
+        assert(pred.category);
+
+        #pragma omp critical
+        {
+          std::cout << path << ' ' << pred.label << '\n';
+        }
       }
     }
   }
@@ -135,7 +211,13 @@ int main(int argc, char *argv[]) {
 
 usage:
   std::cerr << "Usage: " << argv[0]
-    << " [-v vocab-file] [-m map-file] [-c classifier] [cats-file]\n";
+    << " [-v vocab-file] [-m map-file] [-c classifier]"
+    " [--stream [--window size] | --pipeline threads [--queue capacity]]"
+    " [-z zip-file | -p pack-file] [--fold fold-id] [--category category]"
+    " [--tent engine] [--dense] [--intra]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]"
+    " [--stats] [--stats-interval seconds]"
+    " [cats-file]\n";
 err:
   return 1;
 }
@@ -0,0 +1,123 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "protocol.h"
+#include "strokes.h"
+
+int main(int argc, char *argv[]) {
+  // Process the command-line arguments.
+  const char *socket_path = default_socket_path;
+  std::uint32_t type = request_svg;
+  std::vector< std::string > paths;
+
+  {
+    int i;
+    for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h")) {
+        goto usage;
+      }
+      else if (!strcmp(argv[i], "-s")) {
+        socket_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-t")) {
+        type = request_strokes;
+      }
+      else {
+        break;
+      }
+    }
+
+    for (; i < argc; ++i)
+      paths.push_back(argv[i]);
+
+    if (!socket_path)
+      goto usage;
+  }
+
+  {
+    // Read paths from standard input if none were given.
+    if (paths.empty()) {
+      for (std::string path; std::getline(std::cin, path);)
+        paths.push_back(path);
+    }
+
+    const int fd = connect_socket(socket_path);
+    if (fd < 0) {
+      std::cerr << argv[0] << ": Unable to connect to `" << socket_path
+        << "'\n";
+      goto err;
+    }
+
+    // Send each sketch in turn, printing the predicted category followed by
+    // the top scores.
+    int res = 0;
+    for (const auto &path : paths) {
+      std::string payload;
+      {
+        std::ifstream fs(path, std::ios::binary);
+        if (!fs) {
+          std::cerr << argv[0] << ": Unable to read `" << path << "'\n";
+          res = 1;
+          continue;
+        }
+        payload.assign(std::istreambuf_iterator< char >(fs),
+          std::istreambuf_iterator< char >());
+      }
+
+      // Send strokes in binary format, so the server does not parse text.
+      if (type == request_strokes &&
+        !is_binary_strokes(payload.data(), payload.size())) {
+        strokes_type strokes;
+        std::ostringstream ss;
+        try {
+          parse_strokes(payload.data(), payload.size(), strokes);
+          write_strokes_binary(ss, strokes);
+        }
+        catch (const stroke_error &e) {
+          std::cerr << argv[0] << ": " << path << ": " << e.what() << '\n';
+          res = 1;
+          continue;
+        }
+        payload = ss.str();
+      }
+
+      std::uint32_t status;
+      std::string response;
+      if (!write_message(fd, type, payload) ||
+        !read_message(fd, status, response)) {
+        std::cerr << argv[0] << ": Lost connection to server\n";
+        close(fd);
+        goto err;
+      }
+
+      if (status != response_ok) {
+        std::cerr << argv[0] << ": " << path << ": " << response;
+        res = 1;
+        continue;
+      }
+
+      std::istringstream ss(response);
+      std::string line;
+      std::getline(ss, line);
+      std::cout << path << ' ' << line << '\n';
+      while (std::getline(ss, line))
+        std::cout << "  " << line << '\n';
+    }
+
+    close(fd);
+    return res;
+  }
+
+usage:
+  std::cerr << "Usage: " << argv[0] << " [-s socket-file] [-t] [file...]\n";
+err:
+  return 1;
+}
@@ -1,12 +1,67 @@
 #ifndef CONV_H
 #define CONV_H
 
+#include <algorithm>
 #include <complex>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
 
 #include <dlib/matrix.h>
 #include <fftw3.h>
 
+#include "util.h"
+
+// Options for planning FFTs
+//
+// These are read when a convolution is first constructed, so they must be
+// set before any features are extracted.
+struct fft_options {
+  fft_options() : wisdom_path(nullptr), flags(FFTW_PATIENT) {
+  }
+
+  // The file used to save plans between runs, or null (the default) to
+  // always plan from scratch without touching the file system
+  const char *wisdom_path;
+
+  // The planning effort
+  unsigned flags;
+};
+
+inline fft_options &fft_settings() {
+  static fft_options options;
+  return options;
+}
+
+// Set the planning effort by name, returning false if it is unknown.
+inline bool set_fft_effort(const char *name) {
+  static const struct {
+    const char *name;
+    unsigned flags;
+  } efforts[] = {
+    { "estimate", FFTW_ESTIMATE },
+    { "measure", FFTW_MEASURE },
+    { "patient", FFTW_PATIENT },
+    { "exhaustive", FFTW_EXHAUSTIVE }
+  };
+
+  for (const auto &effort : efforts) {
+    if (!strcmp(name, effort.name)) {
+      fft_settings().flags = effort.flags;
+      return true;
+    }
+  }
+  return false;
+}
+
 template< class T >
 struct fftw_helper;
 
@@ -33,19 +88,149 @@ struct fftw_helper< float > {
     float *out) {
     fftwf_execute_dft_c2r(p, in, out);
   }
+
+  static inline plan_type plan_many_dft_r2c(int n0, int n1, int howmany,
+    float *in, fftwf_complex *out, unsigned flags) {
+    const int n[] = { n0, n1 };
+    return fftwf_plan_many_dft_r2c(2, n, howmany, in, nullptr, 1, n0 * n1,
+      out, nullptr, 1, n0 * (n1 / 2 + 1), flags);
+  }
+
+  static inline plan_type plan_many_dft_c2r(int n0, int n1, int howmany,
+    fftwf_complex *in, float *out, unsigned flags) {
+    const int n[] = { n0, n1 };
+    return fftwf_plan_many_dft_c2r(2, n, howmany, in, nullptr, 1,
+      n0 * (n1 / 2 + 1), out, nullptr, 1, n0 * n1, flags);
+  }
+
+  static inline void *malloc(std::size_t n) {
+    return fftwf_malloc(n);
+  }
+
+  static inline void free(void *p) {
+    fftwf_free(p);
+  }
+
+  static inline bool import_wisdom_from_string(const char *wisdom) {
+    return fftwf_import_wisdom_from_string(wisdom);
+  }
+
+  static inline char *export_wisdom_to_string() {
+    return fftwf_export_wisdom_to_string();
+  }
+};
+
+// Load saved wisdom before planning, returning the imported wisdom.
+template< class T >
+std::string fftw_load_wisdom(const char *path) {
+  std::string wisdom;
+  if (path) {
+    std::ifstream fs(path);
+    wisdom.assign(std::istreambuf_iterator< char >(fs),
+      std::istreambuf_iterator< char >());
+    if (!wisdom.empty() &&
+      !fftw_helper< T >::import_wisdom_from_string(wisdom.c_str()))
+      wisdom.clear();
+  }
+  return wisdom;
+}
+
+// Save the accumulated wisdom after planning if it has changed.  The file is
+// replaced atomically, since several processes may plan at once.
+template< class T >
+void fftw_save_wisdom(const char *path, const std::string &old_wisdom) {
+  if (!path)
+    return;
+
+  char *wisdom = fftw_helper< T >::export_wisdom_to_string();
+  if (!wisdom)
+    return;
+
+  if (old_wisdom != wisdom) {
+    const std::string tmp_path = std::string(path) + ".tmp";
+    bool ok;
+    {
+      std::ofstream fs(tmp_path);
+      ok = static_cast< bool >(fs << wisdom);
+    }
+    if (!ok || std::rename(tmp_path.c_str(), path))
+      std::remove(tmp_path.c_str());
+  }
+
+  std::free(wisdom);
+}
+
+// An array allocated with the SIMD alignment FFTW expects
+template< class T, class U >
+struct fftw_array {
+  fftw_array() : data(nullptr), size(0) {
+  }
+
+  explicit fftw_array(std::size_t n) : data(nullptr), size(0) {
+    resize(n);
+  }
+
+  fftw_array(const fftw_array &) = delete;
+  fftw_array &operator=(const fftw_array &) = delete;
+
+  ~fftw_array() {
+    fftw_helper< T >::free(data);
+  }
+
+  // Resize the array, discarding its contents.
+  void resize(std::size_t n) {
+    if (n == size)
+      return;
+    fftw_helper< T >::free(data);
+    data = static_cast< U * >(fftw_helper< T >::malloc(n * sizeof(U)));
+    if (!data && n)
+      throw std::bad_alloc();
+    size = n;
+  }
+
+  U *data;
+  std::size_t size;
 };
 
 // A class for FFT-based convolution with a fixed kernel
+//
+// Plans are made using the current FFT options.  Saved wisdom is reused when
+// available, so only the first run on a machine pays the full planning cost.
+//
+// Besides single images, up to `batch' images can be convolved together
+// using FFTW's advanced interface.  The images are transformed as one
+// contiguous block with a single plan and share the transformed kernel,
+// which saves per-transform overhead and improves locality.
 template< class T, long NR, long NC, bool Verbose = false >
 struct conv_fft {
-  conv_fft(const dlib::matrix< T, NR, NC > &h) {
-    dlib::matrix< T, NR, NC > x;
-    dlib::matrix< std::complex< T >, NR, NC_Comp > xf;
+  typedef dlib::matrix< T, NR, NC > matrix_type;
+
+  explicit conv_fft(const matrix_type &h, std::size_t batch_ = 1) :
+    batch(batch_ ? batch_ : 1) {
+    // Plan on the heap, as images are usually stored.
+    std::unique_ptr< matrix_type > x(new matrix_type);
+    fftw_array< T, std::complex< T > > xf(NR * NC_Comp);
 
-    plan = fftw_helper< T >::plan_dft_r2c_2d(NR, NC, &x(0, 0),
-      reinterpret_cast< T (*)[2] >(&xf(0, 0)), FFTW_PATIENT);
+    const fft_options &options = fft_settings();
+    const std::string wisdom = fftw_load_wisdom< T >(options.wisdom_path);
+
+    plan = fftw_helper< T >::plan_dft_r2c_2d(NR, NC, &(*x)(0, 0),
+      reinterpret_cast< T (*)[2] >(xf.data), options.flags);
     inv_plan = fftw_helper< T >::plan_dft_c2r_2d(NR, NC,
-      reinterpret_cast< T (*)[2] >(&xf(0, 0)), &x(0, 0), FFTW_PATIENT);
+      reinterpret_cast< T (*)[2] >(xf.data), &(*x)(0, 0), options.flags);
+
+    if (batch > 1) {
+      // Plan using scratch arrays, since planning overwrites its input.
+      fftw_array< T, T > xs(batch * NR * NC);
+      fftw_array< T, std::complex< T > > xfs(batch * NR * NC_Comp);
+
+      batch_plan = fftw_helper< T >::plan_many_dft_r2c(NR, NC, batch,
+        xs.data, reinterpret_cast< T (*)[2] >(xfs.data), options.flags);
+      inv_batch_plan = fftw_helper< T >::plan_many_dft_c2r(NR, NC, batch,
+        reinterpret_cast< T (*)[2] >(xfs.data), xs.data, options.flags);
+    }
+
+    fftw_save_wisdom< T >(options.wisdom_path, wisdom);
 
     if (Verbose) {
       std::cout << "FFT plan:\n";
@@ -57,34 +242,235 @@ struct conv_fft {
       std::cout << '\n';
     }
 
-    // Store the transformed kernel.
-    fftw_helper< T >::execute_dft_r2c(plan, const_cast< T * >(&h(0, 0)),
-      reinterpret_cast< T (*)[2] >(&hf(0, 0)));
+    // Store the transformed kernel, transforming it in the arrays used for
+    // planning so their alignment matches the plan.
+    *x = h;
+    fftw_helper< T >::execute_dft_r2c(plan, &(*x)(0, 0),
+      reinterpret_cast< T (*)[2] >(xf.data));
+    std::copy(xf.data, xf.data + NR * NC_Comp, &hf(0, 0));
     hf /= NR * NC;
   }
 
+  conv_fft(const conv_fft &) = delete;
+  conv_fft &operator=(const conv_fft &) = delete;
+
   ~conv_fft() {
     fftwf_destroy_plan(plan);
     fftwf_destroy_plan(inv_plan);
+    if (batch > 1) {
+      fftwf_destroy_plan(batch_plan);
+      fftwf_destroy_plan(inv_batch_plan);
+    }
   }
 
-  void operator()(dlib::matrix< T, NR, NC > &x) const {
-    dlib::matrix< std::complex< T >, NR, NC_Comp > xf;
+  void operator()(matrix_type &x) const {
+    static const std::size_t comp_size = NR * NC_Comp;
+
+    // Each thread transforms in its own buffer.
+    static thread_local fftw_array< T, std::complex< T > > buf_f;
+    buf_f.resize(comp_size);
 
-    fftw_helper< T >::execute_dft_r2c(plan, const_cast< T * >(&x(0, 0)),
-      reinterpret_cast< T (*)[2] >(&xf(0, 0)));
-    xf = pointwise_multiply(xf, hf);
+    fftw_helper< T >::execute_dft_r2c(plan, &x(0, 0),
+      reinterpret_cast< T (*)[2] >(buf_f.data));
+
+    const std::complex< T > *h = &hf(0, 0);
+    for (std::size_t k = 0; k < comp_size; ++k)
+      buf_f.data[k] *= h[k];
 
     fftw_helper< T >::execute_dft_c2r(inv_plan,
-      reinterpret_cast< T (*)[2] >(&xf(0, 0)), &x(0, 0));
+      reinterpret_cast< T (*)[2] >(buf_f.data), &x(0, 0));
+  }
+
+  // Convolve an array of images in place, in batches where possible.
+  void operator()(matrix_type *xs, std::size_t count) const {
+    std::size_t k = 0;
+    if (batch > 1) {
+      for (; k + batch <= count; k += batch)
+        convolve_batch(xs + k);
+    }
+    for (; k < count; ++k)
+      (*this)(xs[k]);
   }
 
 private:
   static const long NC_Comp = NC / 2 + 1;
 
+  void convolve_batch(matrix_type *xs) const {
+    static const std::size_t size = NR * NC;
+    static const std::size_t comp_size = NR * NC_Comp;
+
+    // Each thread transforms in its own aligned buffers.
+    static thread_local fftw_array< T, T > buf;
+    static thread_local fftw_array< T, std::complex< T > > buf_f;
+    buf.resize(batch * size);
+    buf_f.resize(batch * comp_size);
+
+    for (std::size_t b = 0; b < batch; ++b)
+      std::memcpy(buf.data + b * size, &xs[b](0, 0), size * sizeof(T));
+
+    fftw_helper< T >::execute_dft_r2c(batch_plan, buf.data,
+      reinterpret_cast< T (*)[2] >(buf_f.data));
+
+    const std::complex< T > *h = &hf(0, 0);
+    for (std::size_t b = 0; b < batch; ++b) {
+      std::complex< T > *xf = buf_f.data + b * comp_size;
+      for (std::size_t k = 0; k < comp_size; ++k)
+        xf[k] *= h[k];
+    }
+
+    fftw_helper< T >::execute_dft_c2r(inv_batch_plan,
+      reinterpret_cast< T (*)[2] >(buf_f.data), buf.data);
+
+    for (std::size_t b = 0; b < batch; ++b)
+      std::memcpy(&xs[b](0, 0), buf.data + b * size, size * sizeof(T));
+  }
+
+  const std::size_t batch;
+
   typename fftw_helper< T >::plan_type plan, inv_plan;
+  typename fftw_helper< T >::plan_type batch_plan, inv_batch_plan;
 
   dlib::matrix< std::complex< T >, NR, NC_Comp > hf;
 };
 
+// Apply a circular box filter along one dimension.
+//
+// For each position p and lane l, `out' receives the sum of
+// in[(p - k) mod n] for k in [offset, offset + len).  Elements are `stride'
+// apart and each element has `lanes' lanes, so the same routine filters rows
+// one at a time or whole columns at once.  The number of nonzero inputs in
+// each window is tracked alongside the sum, so windows of zeros produce
+// exact zeros rather than rounding residue.
+template< class T >
+void box_filter_circular(const T *in, T *out, long n, long stride,
+  long lanes, long len, long offset, double *acc, long *nonzero) {
+  const auto at = [&](long p) { return ((p % n) + n) % n * stride; };
+
+  for (long l = 0; l < lanes; ++l) {
+    acc[l] = 0;
+    nonzero[l] = 0;
+  }
+  for (long k = offset; k < offset + len; ++k) {
+    const T *q = in + at(-k);
+    for (long l = 0; l < lanes; ++l) {
+      acc[l] += q[l];
+      nonzero[l] += (q[l] != 0);
+    }
+  }
+
+  // Slide the window, adding the element entering it and removing the one
+  // leaving it.
+  for (long p = 0; p < n; ++p) {
+    T *r = out + p * stride;
+    for (long l = 0; l < lanes; ++l)
+      r[l] = nonzero[l] ? std::max(acc[l], 0.) : 0;
+
+    const T *q_in = in + at(p + 1 - offset);
+    const T *q_out = in + at(p + 1 - offset - len);
+    for (long l = 0; l < lanes; ++l) {
+      acc[l] += q_in[l] - q_out[l];
+      nonzero[l] += (q_in[l] != 0) - (q_out[l] != 0);
+    }
+  }
+}
+
+// A class for exact convolution with a 2D tent kernel
+//
+// The tent kernel of half-width s used for descriptor interpolation is the
+// product of two 1D tents, and each 1D tent is a box of width s convolved
+// with itself.  The convolution is therefore four running-sum passes, which
+// take O(NR * NC) time for any s.  The result is the same circular
+// convolution conv_fft computes with the kernel from tent_kernel_init, but
+// without the ringing of the FFT.  The inputs are assumed to be
+// non-negative.
+//
+// When the nonzero inputs are known to lie within a region, only the rows
+// and columns the kernel can reach from it are filtered.  Everything outside
+// the support of the result is exactly zero.
+template< class T, long NR, long NC >
+struct conv_tent_box {
+  typedef dlib::matrix< T, NR, NC > matrix_type;
+
+  explicit conv_tent_box(unsigned int size_) : size(size_) {
+  }
+
+  // Return the region that may be nonzero after convolving an image whose
+  // nonzero values lie within a region.
+  image_region support(const image_region &r) const {
+    if (r.empty())
+      return r;
+
+    // The tent has nonzero taps at offsets [1, 2s - 1].
+    image_region s = {
+      r.top + 1, r.bottom + 2 * size - 1,
+      r.left + 1, r.right + 2 * size - 1
+    };
+
+    // Use whole rows or columns if the support wraps around.
+    if (s.bottom > NR) {
+      s.top = 0;
+      s.bottom = NR;
+    }
+    if (s.right > NC) {
+      s.left = 0;
+      s.right = NC;
+    }
+    return s;
+  }
+
+  void operator()(matrix_type &x) const {
+    const image_region r = { 0, NR, 0, NC };
+    (*this)(x, r);
+  }
+
+  // Convolve an image whose nonzero values lie within a region.
+  void operator()(matrix_type &x, const image_region &r) const {
+    if (r.empty())
+      return;
+
+    // Each thread filters in its own buffers.
+    static thread_local std::vector< T > tmp;
+    static thread_local std::vector< double > acc;
+    static thread_local std::vector< long > nonzero;
+    tmp.resize(NR * NC);
+    acc.resize(std::max(NR, NC));
+    nonzero.resize(std::max(NR, NC));
+
+    T *p = &x(0, 0);
+
+    // Filter each row with the two boxes.  The second box is offset by one,
+    // which places the peak of the tent at s, as in tent_kernel_init.  Rows
+    // outside the region are zero and stay zero.
+    for (long j = r.top; j < r.bottom; ++j) {
+      box_filter_circular(p + j * NC, tmp.data() + j * NC, NC, 1, 1, size, 0,
+        acc.data(), nonzero.data());
+      box_filter_circular(tmp.data() + j * NC, p + j * NC, NC, 1, 1, size, 1,
+        acc.data(), nonzero.data());
+    }
+
+    // Filter the columns the row pass can have reached, processing whole
+    // rows at a time.
+    const image_region s = support(r);
+    const long lanes = s.right - s.left;
+    box_filter_circular(p + s.left, tmp.data() + s.left, NR, NC, lanes, size,
+      0, acc.data(), nonzero.data());
+    box_filter_circular(tmp.data() + s.left, p + s.left, NR, NC, lanes, size,
+      1, acc.data(), nonzero.data());
+  }
+
+  void operator()(matrix_type *xs, std::size_t count) const {
+    for (std::size_t k = 0; k < count; ++k)
+      (*this)(xs[k]);
+  }
+
+  void operator()(matrix_type *xs, std::size_t count,
+    const image_region &r) const {
+    for (std::size_t k = 0; k < count; ++k)
+      (*this)(xs[k], r);
+  }
+
+private:
+  const long size;
+};
+
 #endif
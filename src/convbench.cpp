@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "features.h"
+#include "input.h"
+#include "model.h"
+#include "svg.h"
+#include "types.h"
+
+namespace {
+
+typedef std::vector< image_type > responses_type;
+
+// Time an engine over every set of responses, returning the mean time per
+// sketch in microseconds.  The convolved responses are stored in `out'.
+template< class Conv >
+double time_engine(const std::vector< responses_type > &in,
+  unsigned int repeats, Conv conv, std::vector< responses_type > &out) {
+  typedef std::chrono::steady_clock clock_type;
+
+  clock_type::duration elapsed(0);
+  for (unsigned int r = 0; r < repeats; ++r) {
+    out = in;
+    const auto start = clock_type::now();
+    for (auto &os : out)
+      conv(os);
+    elapsed += clock_type::now() - start;
+  }
+
+  return std::chrono::duration< double, std::micro >(elapsed).count() /
+    (repeats * in.size());
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  // Process the command-line arguments.
+  unsigned int repeats = 10;
+  const char *zip_path = nullptr;
+  const char *pack_path = nullptr;
+  const char *fold_id = nullptr;
+  const char *category = nullptr;
+
+  {
+    int i;
+    for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h")) {
+        goto usage;
+      }
+      else if (!strcmp(argv[i], "-r")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> repeats) || !repeats)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-z")) {
+        zip_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-p")) {
+        pack_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--fold")) {
+        fold_id = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--category")) {
+        category = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else {
+        break;
+      }
+    }
+
+    if (i != argc)
+      goto usage;
+
+    if ((fold_id || category) && !zip_path && !pack_path)
+      goto usage;
+
+    if (zip_path && pack_path)
+      goto usage;
+  }
+
+  {
+    // Find the input files.
+    sketch_source sketches;
+    if (zip_path)
+      sketches.open_archive(zip_path);
+    if (pack_path)
+      sketches.open_pack(pack_path, image_type::NR);
+    if (fold_id || category || pack_path)
+      sketches.select(fold_id, category);
+    else
+      sketches.read_paths(std::cin);
+
+    if (!sketches.size()) {
+      std::cerr << argv[0] << ": No sketches to benchmark\n";
+      goto err;
+    }
+
+    // Compute the orientational responses up front, so only the tent
+    // convolution is timed.
+    std::cout << "Computing responses for " << sketches.size()
+      << " sketches...\n";
+    std::vector< responses_type > in(sketches.size());
+    for (typename sketch_source::size_type i = 0; i < sketches.size(); ++i) {
+      auto &buffers = sketch_workspace::local().buffers< image_type::NR >();
+      sketches.load(i, buffers.image);
+      feature_desc_extractor_type::responses(buffers.image, buffers);
+      in[i] = buffers.os;
+    }
+
+    // Plan before timing.
+    std::cout << "Planning...\n";
+    const auto &fft = feature_desc_extractor_type::conv_tent();
+    const conv_tent_box< float, image_type::NR, image_type::NC > box(
+      feature_desc_extractor_type::spatial_bin_size);
+
+    std::vector< responses_type > fft_out, box_out;
+
+    const double fft_time = time_engine(in, repeats,
+      [&](responses_type &os) {
+        fft(os.data(), os.size());
+        for (auto &o : os)
+          o = abs(o);
+      }, fft_out);
+
+    const double box_time = time_engine(in, repeats,
+      [&](responses_type &os) { box(os.data(), os.size()); }, box_out);
+
+    // Compare the results of the two engines.
+    float max_diff = 0, max_value = 0;
+    for (std::vector< responses_type >::size_type k = 0; k < in.size(); ++k) {
+      for (responses_type::size_type i = 0; i < in[k].size(); ++i) {
+        max_diff = std::max(max_diff,
+          max(abs(fft_out[k][i] - box_out[k][i])));
+        max_value = std::max(max_value, max(box_out[k][i]));
+      }
+    }
+
+    std::cout << "fft: " << fft_time << " us/sketch\n"
+      << "box: " << box_time << " us/sketch\n"
+      << "Maximum difference: " << max_diff << " (relative: "
+      << ((max_value > 0) ? max_diff / max_value : 0) << ")\n";
+  }
+
+  return 0;
+
+usage:
+  std::cerr << "Usage: " << argv[0] << " [-r repeats]"
+    " [-z zip-file | -p pack-file] [--fold fold-id] [--category category]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]\n";
+err:
+  return 1;
+}
@@ -9,11 +9,119 @@
 #include <vector>
 
 #include "features.h"
+#include "input.h"
 #include "io.h"
+#include "model.h"
+#include "sketch_pipeline.h"
+#include "stats.h"
 #include "svm.h"
 #include "svg.h"
 #include "types.h"
 
+namespace {
+
+// The inputs and options for cross-validating a classifier
+struct validation {
+  const sketch_source &sketches;
+  std::map< std::string, int > &cat_map;
+  const vocab_type &vocab;
+  model_sizes sizes;
+  const char *conf_path;
+  long folds;
+  bool ova;
+  float gamma, c;
+  bool quiet;
+  const pipeline_options *pipe; // Run on a pipeline, unless null
+
+  // Extract features for all input files, then cross-validate a classifier
+  // for a vocabulary of V words and save its confusion matrix.
+  template< long V >
+  void operator()(size_tag< V >) const {
+    typedef classifier_types< V > types;
+    typedef typename types::hist_type hist_type;
+
+    // Each sketch has its own slot, so the samples are in input order no
+    // matter which thread extracts them.
+    std::vector< hist_type > samples(sketches.size());
+    std::vector< int > labels(sketches.size());
+
+    // Get the category of each sketch from its directory name.
+    for (typename sketch_source::size_type i = 0; i < sketches.size(); ++i) {
+      labels[i] = cat_map[sketches.category(i)];
+      assert(labels[i]);
+    }
+
+    if (pipe) {
+      run_sketch_pipeline(sketches, sizes, *pipe,
+        [&](sketch_job &job) {
+          feature_hist(job.ws.descs, job.ws.empty, vocab, samples[job.index]);
+        },
+        [&](sketch_job &job) {
+          if (!quiet) {
+            std::cout << "Extracted features for " << sketches.path(job.index)
+              << " (" << job.index + 1 << '/' << sketches.size() << ")\n";
+          }
+        });
+    }
+    else {
+      #pragma omp parallel for schedule(dynamic)
+      for (typename sketch_source::size_type i = 0; i < sketches.size();
+        ++i) {
+        const std::string &path = sketches.path(i);
+
+        if (!quiet) {
+          #pragma omp critical
+          {
+            std::cout << "Extracting features for " << path << " (" << i + 1
+              << '/' << sketches.size() << ")...\n";
+          }
+        }
+
+        // Extract the features and store the feature histogram.
+        sketch_workspace &ws = sketch_workspace::local();
+        extract_sized(sizes, make_loader(sketches, i), ws);
+        feature_hist(ws.descs, ws.empty, vocab, samples[i]);
+      }
+    }
+
+    // Train a multi-class classifier.
+    typename types::trainer_type rbf_trainer;
+    rbf_trainer.set_kernel(typename types::kernel_type(gamma));
+    rbf_trainer.set_c(c);
+
+    dlib::matrix< double > conf;
+    if (ova) {
+      typedef typename types::ova_trainer_type ova_trainer_type;
+      std::cout << "Cross-validating one-vs-all classifier using " << folds
+        << " folds...\n";
+      conf = cross_validate_multiclass_trainer2< ova_trainer_type,
+        hist_type, int, true >(ova_trainer_type(rbf_trainer), samples,
+        labels, folds);
+    }
+    else {
+      typedef typename types::ovo_trainer_type ovo_trainer_type;
+      std::cout << "Cross-validating one-vs-one classifier using " << folds
+        << " folds...\n";
+      conf = cross_validate_multiclass_trainer2< ovo_trainer_type,
+        hist_type, int, true >(ovo_trainer_type(rbf_trainer), samples,
+        labels, folds);
+    }
+
+    const std::vector< int > distinct_labels =
+      dlib::select_all_distinct_labels(labels);
+
+    // Save the confusion matrix.
+    std::cout << "Saving confusion matrix...\n";
+    {
+      std::ofstream fs(conf_path, std::ios::binary);
+      serialize2(distinct_labels, fs);
+      serialize2(conf, fs);
+    }
+  }
+};
+
+}
+
 int main(int argc, char *argv[]) {
   // Process the command-line arguments.
   long folds = 8;
@@ -23,6 +131,14 @@ int main(int argc, char *argv[]) {
   bool ova = true;
   typename kernel_type::scalar_type gamma = 17.8;
   typename kernel_type::scalar_type c = 3.2;
+  const char *zip_path = nullptr;
+  const char *pack_path = nullptr;
+  const char *fold_id = nullptr;
+  const char *category = nullptr;
+  bool quiet = false;
+  double stats_interval = 0;
+  bool use_pipeline = false;
+  pipeline_options pipe = default_pipeline_options();
 
   {
     int i;
@@ -30,6 +146,9 @@ int main(int argc, char *argv[]) {
       if (!strcmp(argv[i], "-h")) {
         goto usage;
       }
+      else if (!strcmp(argv[i], "-q")) {
+        quiet = true;
+      }
       else if (!strcmp(argv[i], "-f")) {
         std::istringstream ss(argv[++i]);
         if (!(ss >> folds))
@@ -65,6 +184,54 @@ int main(int argc, char *argv[]) {
         if (!(ss >> c))
           goto usage;
       }
+      else if (!strcmp(argv[i], "-z")) {
+        zip_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-p")) {
+        pack_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--fold")) {
+        fold_id = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--category")) {
+        category = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--tent")) {
+        if (!set_tent_engine(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--dense")) {
+        feature_settings().sparse = false;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--pipeline")) {
+        if (!parse_pipeline_threads(argv[++i], pipe))
+          goto usage;
+        use_pipeline = true;
+      }
+      else if (!strcmp(argv[i], "--queue")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> pipe.capacity) || !pipe.capacity)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--stats")) {
+        stats_enabled() = true;
+      }
+      else if (!strcmp(argv[i], "--stats-interval")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> stats_interval) || stats_interval <= 0)
+          goto usage;
+        stats_enabled() = true;
+      }
       else {
         break;
       }
@@ -76,126 +243,57 @@ int main(int argc, char *argv[]) {
     if (i != argc)
       goto usage;
 
+    if ((fold_id || category) && !zip_path && !pack_path)
+      goto usage;
+
+    if (zip_path && pack_path)
+      goto usage;
+
     if (!vocab_path || !map_path)
       goto usage;
   }
 
   {
+    const stats_reporter reporter(std::cerr, stats_interval);
+
     // Load the vocabulary.
     std::cout << "Loading vocabulary...\n";
     vocab_type vocab;
-    {
-      std::ifstream fs(vocab_path, std::ios::binary);
-      deserialize2(vocab, fs);
-    }
+    const model_sizes sizes = load_vocab(vocab_path, vocab);
+    check_model_engine(sizes);
 
     // Load the category map.
     std::cout << "Loading category map...\n";
     std::map< std::string, int > cat_map;
-    {
-      std::ifstream fs(map_path);
-      for (std::string line; std::getline(fs, line);) {
-        std::istringstream ss(line);
-        int i;
-        std::string label;
-        ss >> i;
-        ss.get(); // ','
-        std::getline(ss, label);
-        cat_map[label] = i;
-      }
-      fs.close();
-    }
-
-    // Extract features for all input files.
-    std::vector< feature_hist_type > samples;
-    std::vector< int > labels;
-
-    std::vector< std::string > paths;
-    std::string path;
-    while (std::getline(std::cin, path))
-      paths.push_back(path);
-
-    #pragma omp parallel for schedule(dynamic)
-    for (typename std::vector< std::string >::size_type i = 0;
-      i < paths.size(); ++i) {
-      const std::string &path = paths[i];
-
-      #pragma omp critical
-      {
-        std::cout << "Extracting features for " << path << " (" << i + 1
-          << '/' << paths.size() << ")...\n";
-      }
+    load_category_ids(map_path, cat_map);
 
-      // Get the category from the directory name.
-      const std::size_t dir_end = path.rfind('/');
-      std::size_t dir_begin = path.rfind('/', dir_end - 1);
-      if (dir_begin == std::string::npos)
-        dir_begin = 0;
-      else
-        ++dir_begin;
+    // Find the input files.
+    sketch_source sketches;
+    if (zip_path)
+      sketches.open_archive(zip_path);
+    if (pack_path)
+      sketches.open_pack(pack_path, sizes.image_size);
+    if (fold_id || category || pack_path)
+      sketches.select(fold_id, category);
+    else
+      sketches.read_paths(std::cin);
 
-      const std::string dir = path.substr(dir_begin, dir_end - dir_begin);
-      const int cat = cat_map[dir];
-
-      assert(cat);
-
-      // Extract the features.
-      image_type image;
-      load_svg(path.c_str(), image);
-      image = 1. - image;
-
-      std::vector< feature_desc_type > descs;
-      extract_descriptors(image, descs);
-
-      feature_hist_type hist;
-      feature_hist(descs, vocab, hist);
-
-      // Store the category label and feature histogram.
-      #pragma omp critical
-      {
-        samples.push_back(hist);
-        labels.push_back(cat);
-      }
-    }
-
-    // Train a multi-class classifier.
-    trainer_type rbf_trainer;
-    rbf_trainer.set_kernel(kernel_type(gamma));
-    rbf_trainer.set_c(c);
-
-    dlib::matrix< double > conf;
-    if (ova) {
-      std::cout << "Cross-validating one-vs-all classifier using " << folds
-        << " folds...\n";
-      conf = cross_validate_multiclass_trainer2< ova_trainer_type,
-        feature_hist_type, int, true >(ova_trainer_type(rbf_trainer), samples,
-        labels, folds);
-    }
-    else {
-      std::cout << "Cross-validating one-vs-one classifier using " << folds
-        << " folds...\n";
-      conf = cross_validate_multiclass_trainer2< ovo_trainer_type,
-        feature_hist_type, int, true >(ovo_trainer_type(rbf_trainer), samples,
-        labels, folds);
-    }
-
-    const std::vector< int > distinct_labels =
-      dlib::select_all_distinct_labels(labels);
-
-    // Save the confusion matrix.
-    std::cout << "Saving confusion matrix...\n";
-    {
-      std::ofstream fs(conf_path, std::ios::binary);
-      serialize2(distinct_labels, fs);
-      serialize2(conf, fs);
-    }
+    const validation v = { sketches, cat_map, vocab, sizes, conf_path, folds,
+      ova, gamma, c, quiet, use_pipeline ? &pipe : nullptr };
+    dispatch_word_count(sizes.word_count, v);
   }
 
   return 0;
 
 usage:
-  std::cerr << "Usage: " << argv[0] << " [-f folds] [-v vocab-file]"
-    " [-m map-file] [-c classifier] [-g gamma] [-C C] [conf-file]\n";
+  std::cerr << "Usage: " << argv[0] << " [-q] [-f folds] [-v vocab-file]"
+    " [-m map-file] [-c classifier] [-g gamma] [-C C]"
+    " [-z zip-file | -p pack-file] [--fold fold-id] [--category category]"
+    " [--tent engine] [--dense]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]"
+    " [--pipeline threads [--queue capacity]]"
+    " [--stats] [--stats-interval seconds]"
+    " [conf-file]\n";
 err:
   return 1;
 }
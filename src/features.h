@@ -1,14 +1,80 @@
 #ifndef FEATURES_H
 #define FEATURES_H
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <dlib/matrix.h>
 
 #include "conv.h"
+#include "stats.h"
 #include "util.h"
 
+// The methods for convolving orientational responses with the tent kernel
+enum tent_engine_type {
+  tent_fft, // Multiply in the frequency domain using FFTW
+  tent_box  // Apply running box sums in the spatial domain
+};
+
+// Options for feature extraction
+//
+// These must be set before any features are extracted.
+struct feature_options {
+  feature_options() : tent_engine(tent_fft), tent_engine_set(false),
+    sparse(true), intra_sketch(false) {
+  }
+
+  // The engines give different descriptors where the image is blank, since
+  // the FFT leaves rounding noise there that normalization makes unit
+  // length.  A vocabulary and the classifiers trained with it are only valid
+  // with the engine they were built with, which is stored with them, so this
+  // only selects the engine for building new vocabularies.  Features for a
+  // loaded model are extracted with the model's engine.
+  tent_engine_type tent_engine;
+  bool tent_engine_set; // Whether the engine was chosen explicitly
+
+  // Restrict per-pixel work to the inked region of each image.  This does
+  // not change the results.
+  bool sparse;
+
+  // Split the work on each sketch across the OpenMP threads: the orientation
+  // convolutions and the quantization of the descriptors.  This lowers the
+  // latency of processing one sketch at a time.  It gains nothing when
+  // sketches are already processed in parallel, where the nested regions run
+  // on one thread.  Results may differ in rounding.
+  bool intra_sketch;
+};
+
+inline feature_options &feature_settings() {
+  static feature_options options;
+  return options;
+}
+
+// Set the tent convolution engine by name, returning false if it is unknown.
+inline bool set_tent_engine(const char *name) {
+  if (!strcmp(name, "fft"))
+    feature_settings().tent_engine = tent_fft;
+  else if (!strcmp(name, "box"))
+    feature_settings().tent_engine = tent_box;
+  else
+    return false;
+  feature_settings().tent_engine_set = true;
+  return true;
+}
+
+// Return the name of a tent convolution engine.
+inline const char *tent_engine_name(tent_engine_type engine) {
+  return engine == tent_box ? "box" : "fft";
+}
+
 // Bin the gradient magnitudes by orientation into orientational response
 // images.
 template< class T, long NR, long NC >
@@ -38,6 +104,251 @@ void orient_responses(const dlib::matrix< T, NR, NC > &g,
   }
 }
 
+// Approximate atan(r) / (pi / 4) for r in [0, 1].  The maximum error is
+// about 5e-6.
+template< class T >
+inline T atan_unit(T r) {
+  const T r2 = r * r;
+  return r * (T(1.27321410) + r2 * (T(-0.42350882) + r2 * (T(0.24642576) +
+    r2 * (T(-0.14824739) + r2 * (T(0.06704014) + r2 * T(-0.01492380))))));
+}
+
+// Bin the gradient by orientation into four orientational response images in
+// a single pass.
+//
+// The bin centers are multiples of pi / 4, so the two bins a gradient falls
+// between are given by its octant, and the interpolation weight by the angle
+// within the octant.  That angle is computed from the ratio of the gradient
+// components, so no atan2 or hypot calls are needed.  The result matches
+// cart2polar followed by orient_responses to within the accuracy of
+// atan_unit, including the fact that orient_responses drops orientations in
+// [7 pi / 8, pi), which fall outside all of its bins.
+template< class T >
+void orient_responses4(const T *gx, const T *gy, std::size_t n, T *os0,
+  T *os1, T *os2, T *os3) {
+  for (std::size_t k = 0; k < n; ++k) {
+    T x = gx[k], y = gy[k];
+
+    // Limit the orientation range to [0, pi).
+    if (y < 0 || (y == 0 && x < 0)) {
+      x = -x;
+      y = -y;
+    }
+
+    // Find the position p in [0, 4) of the orientation in units of bins.
+    const T ax = std::abs(x);
+    const T hi = std::max(ax, y), lo = std::min(ax, y);
+    const T a = (hi > 0) ? atan_unit(lo / hi) : 0;
+    T p = (y > ax) ? 2 - a : a;
+    if (x < 0)
+      p = 4 - p;
+
+    const T g = (p < T(3.5)) ? std::sqrt(x * x + y * y) : 0;
+
+    os0[k] = g * (std::max(T(1) - p, T(0)) + std::max(p - 3, T(0)));
+    os1[k] = g * std::max(T(1) - std::abs(p - 1), T(0));
+    os2[k] = g * std::max(T(1) - std::abs(p - 2), T(0));
+    os3[k] = g * std::max(T(1) - std::abs(p - 3), T(0));
+  }
+}
+
+#ifdef __SSE2__
+inline void orient_responses4(const float *gx, const float *gy,
+  std::size_t n, float *os0, float *os1, float *os2, float *os3) {
+  const auto select = [](__m128 m, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+  };
+  const auto ramp = [](__m128 x) {
+    return _mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.f), x), _mm_setzero_ps());
+  };
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 sign = _mm_set1_ps(-0.f);
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 two = _mm_set1_ps(2.f);
+  const __m128 three = _mm_set1_ps(3.f);
+  const __m128 four = _mm_set1_ps(4.f);
+
+  std::size_t k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128 x = _mm_loadu_ps(gx + k);
+    __m128 y = _mm_loadu_ps(gy + k);
+
+    // Limit the orientation range to [0, pi).
+    const __m128 flip = _mm_or_ps(_mm_cmplt_ps(y, zero),
+      _mm_and_ps(_mm_cmpeq_ps(y, zero), _mm_cmplt_ps(x, zero)));
+    x = _mm_xor_ps(x, _mm_and_ps(flip, sign));
+    y = _mm_xor_ps(y, _mm_and_ps(flip, sign));
+
+    // Find the position p in [0, 4) of the orientation in units of bins.
+    const __m128 ax = _mm_andnot_ps(sign, x);
+    const __m128 hi = _mm_max_ps(ax, y), lo = _mm_min_ps(ax, y);
+    const __m128 r = _mm_and_ps(_mm_div_ps(lo, hi), _mm_cmpgt_ps(hi, zero));
+    const __m128 r2 = _mm_mul_ps(r, r);
+    __m128 a = _mm_set1_ps(-0.01492380f);
+    a = _mm_add_ps(_mm_mul_ps(a, r2), _mm_set1_ps(0.06704014f));
+    a = _mm_add_ps(_mm_mul_ps(a, r2), _mm_set1_ps(-0.14824739f));
+    a = _mm_add_ps(_mm_mul_ps(a, r2), _mm_set1_ps(0.24642576f));
+    a = _mm_add_ps(_mm_mul_ps(a, r2), _mm_set1_ps(-0.42350882f));
+    a = _mm_add_ps(_mm_mul_ps(a, r2), _mm_set1_ps(1.27321410f));
+    a = _mm_mul_ps(a, r);
+
+    __m128 p = select(_mm_cmpgt_ps(y, ax), _mm_sub_ps(two, a), a);
+    p = select(_mm_cmplt_ps(x, zero), _mm_sub_ps(four, p), p);
+
+    const __m128 g = _mm_and_ps(_mm_cmplt_ps(p, _mm_set1_ps(3.5f)),
+      _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y))));
+
+    const auto dist = [&](__m128 c) {
+      return _mm_andnot_ps(sign, _mm_sub_ps(p, c));
+    };
+
+    _mm_storeu_ps(os0 + k, _mm_mul_ps(g, _mm_add_ps(ramp(p),
+      _mm_max_ps(_mm_sub_ps(p, three), zero))));
+    _mm_storeu_ps(os1 + k, _mm_mul_ps(g, ramp(dist(one))));
+    _mm_storeu_ps(os2 + k, _mm_mul_ps(g, ramp(dist(two))));
+    _mm_storeu_ps(os3 + k, _mm_mul_ps(g, ramp(dist(three))));
+  }
+
+  orient_responses4< float >(gx + k, gy + k, n - k, os0 + k, os1 + k,
+    os2 + k, os3 + k);
+}
+#endif
+
+// Interleave four images so the four values for each pixel are adjacent.
+template< class T >
+void interleave4(const T *a, const T *b, const T *c, const T *d, T *out,
+  std::size_t n) {
+  for (std::size_t k = 0; k < n; ++k) {
+    out[4 * k] = a[k];
+    out[4 * k + 1] = b[k];
+    out[4 * k + 2] = c[k];
+    out[4 * k + 3] = d[k];
+  }
+}
+
+#ifdef __SSE2__
+inline void interleave4(const float *a, const float *b, const float *c,
+  const float *d, float *out, std::size_t n) {
+  std::size_t k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128 r0 = _mm_loadu_ps(a + k), r1 = _mm_loadu_ps(b + k);
+    __m128 r2 = _mm_loadu_ps(c + k), r3 = _mm_loadu_ps(d + k);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(out + 4 * k, r0);
+    _mm_storeu_ps(out + 4 * k + 4, r1);
+    _mm_storeu_ps(out + 4 * k + 8, r2);
+    _mm_storeu_ps(out + 4 * k + 12, r3);
+  }
+
+  interleave4< float >(a + k, b + k, c + k, d + k, out + 4 * k, n - k);
+}
+#endif
+
+// Gather a descriptor from interleaved responses with four orientations.
+// p points at the grid point, and offsets holds the offset of each of the n
+// spatial bins.  The values for each orientation are stored contiguously in
+// d.  Return whether any value is nonzero.
+template< class T >
+bool gather4(const T *p, const long *offsets, std::size_t n, T *d) {
+  bool nonzero = false;
+  for (std::size_t k = 0; k < n; ++k) {
+    const T *q = p + offsets[k];
+    for (std::size_t i = 0; i < 4; ++i) {
+      d[i * n + k] = q[i];
+      nonzero = nonzero || q[i] != 0;
+    }
+  }
+  return nonzero;
+}
+
+#ifdef __SSE2__
+inline bool gather4(const float *p, const long *offsets, std::size_t n,
+  float *d) {
+  // Load four bins at a time and transpose them into orientation order.
+  __m128 any = _mm_setzero_ps();
+  std::size_t k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128 r0 = _mm_loadu_ps(p + offsets[k]);
+    __m128 r1 = _mm_loadu_ps(p + offsets[k + 1]);
+    __m128 r2 = _mm_loadu_ps(p + offsets[k + 2]);
+    __m128 r3 = _mm_loadu_ps(p + offsets[k + 3]);
+    any = _mm_or_ps(any, _mm_or_ps(_mm_or_ps(r0, r1), _mm_or_ps(r2, r3)));
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(d + k, r0);
+    _mm_storeu_ps(d + n + k, r1);
+    _mm_storeu_ps(d + 2 * n + k, r2);
+    _mm_storeu_ps(d + 3 * n + k, r3);
+  }
+
+  bool nonzero = _mm_movemask_ps(_mm_cmpneq_ps(any, _mm_setzero_ps())) != 0;
+  for (; k < n; ++k) {
+    const float *q = p + offsets[k];
+    for (std::size_t i = 0; i < 4; ++i) {
+      d[i * n + k] = q[i];
+      nonzero = nonzero || q[i] != 0;
+    }
+  }
+  return nonzero;
+}
+#endif
+
+// The offset of the center of spatial bin k from a grid point in each
+// dimension, for bins of the given size and count
+constexpr int spatial_bin_center(unsigned int size, unsigned int count,
+  unsigned int k) {
+  return static_cast< int >(size / 2) + static_cast< int >(size) *
+    (static_cast< int >(k) - static_cast< int >(count / 2));
+}
+
+// The largest distance from a grid point to a spatial bin center
+constexpr int spatial_bin_margin(unsigned int size, unsigned int count) {
+  return (-spatial_bin_center(size, count, 0) >
+    spatial_bin_center(size, count, count - 1)) ?
+    -spatial_bin_center(size, count, 0) :
+    spatial_bin_center(size, count, count - 1);
+}
+
+// The layout of the spatial bins of a descriptor in interleaved responses
+// with a row stride of Stride pixels and Channels values per pixel
+template< unsigned int Size, unsigned int Count, long Stride,
+  unsigned int Channels >
+struct spatial_bin_layout {
+  // The offset of spatial bin k, in row-major bin order
+  static constexpr long offset(unsigned int k) {
+    return (spatial_bin_center(Size, Count, k / Count) * Stride +
+      spatial_bin_center(Size, Count, k % Count)) * Channels;
+  }
+};
+
+template< unsigned int... I >
+struct index_list {
+};
+
+template< unsigned int N, unsigned int... I >
+struct make_index_list : make_index_list< N - 1, N - 1, I... > {
+};
+
+template< unsigned int... I >
+struct make_index_list< 0, I... > {
+  typedef index_list< I... > type;
+};
+
+// A table of the offsets of each spatial bin in a layout, generated at
+// compile time
+template< class Layout, class Indices >
+struct spatial_bin_offsets;
+
+template< class Layout, unsigned int... I >
+struct spatial_bin_offsets< Layout, index_list< I... > > {
+  static const long values[sizeof...(I)];
+};
+
+template< class Layout, unsigned int... I >
+const long spatial_bin_offsets< Layout, index_list< I... > >::values[] = {
+  Layout::offset(I)...
+};
+
 // A class for extracting feature descriptors from a grayscale image
 template< class T, long N >
 struct feature_desc_extractor {
@@ -47,79 +358,184 @@ struct feature_desc_extractor {
     (N * 0.35355339) / spatial_bin_count; // 12.5% area
   static const unsigned int feature_grid_size = 28;
 
+  // Descriptors are centered on a grid of feature_grid_size points in each
+  // dimension, grid_step pixels apart, so every image size has the same
+  // number of descriptors.  The pixels left over when the size is not a
+  // multiple of the grid size are split between the two sides in whole
+  // steps, which leaves the grid at 256 pixels where it always was.
+  static const unsigned int grid_step = N / feature_grid_size;
+  static const unsigned int grid_offset = grid_step / 2 +
+    (N - feature_grid_size * grid_step) / (2 * grid_step) * grid_step;
+
   typedef dlib::matrix< T, N, N > image_type;
   typedef dlib::matrix< T, orient_bin_count *
     spatial_bin_count * spatial_bin_count, 1 > desc_type;
 
-  static void extract(const image_type &image,
-    std::vector< desc_type > &descs) {
-    descs.clear();
-    descs.reserve(feature_grid_size * feature_grid_size);
+  // The interleaved responses are padded with zeros on every side, so every
+  // spatial bin of every grid point lies within them.
+  static const int bin_margin =
+    spatial_bin_margin(spatial_bin_size, spatial_bin_count);
+  static const long padded_size = N + 2 * bin_margin;
+
+  typedef spatial_bin_offsets< spatial_bin_layout< spatial_bin_size,
+    spatial_bin_count, padded_size, orient_bin_count >,
+    typename make_index_list< spatial_bin_count * spatial_bin_count >::type >
+    bin_offsets;
+
+  // The image and the intermediate results of extraction at this size.
+  // They are owned by a sketch_workspace (see model.h), so extraction
+  // allocates nothing in the steady state and large images stay off the
+  // stack.
+  struct buffers {
+    image_type image; // The input image, if it is rasterized here
+    image_type gx, gy; // The gradient
+    std::vector< image_type > os; // The orientational responses
+
+    // The orientational responses, interleaved so the values for each pixel
+    // are adjacent.  Only the interior is ever written, so the margin stays
+    // zero.
+    std::vector< T > interleaved;
+  };
+
+  // Compute the orientational response images for an image in a set of
+  // buffers, before they are convolved with the tent kernel.  Return a
+  // region outside which all responses are zero.
+  static image_region responses(const image_type &image, buffers &ws) {
+    static_assert(orient_bin_count == 4,
+      "orient_responses4 requires four orientation bins");
+    std::vector< image_type > &os = ws.os;
+    os.resize(orient_bin_count);
+
+    // The gradient is zero more than one pixel away from any ink.
+    image_region r = { 0, N, 0, N };
+    if (feature_settings().sparse) {
+      r = dilate_region(nonzero_region(image), 1, N, N);
+      for (auto &o : os)
+        o = 0;
+      if (r.empty())
+        return r;
+    }
 
     // Compute the gradient.
-    const image_type gx = conv_same(image, sobel_x);
-    const image_type gy = conv_same(image, sobel_y);
-
-    // Compute the magnitude and orientation of the gradient.
-    image_type g, o;
-    cart2polar(gx, gy, g, o);
-
-    // Limit the orientation range to [0, pi).
-    for (long j = 0; j < N; ++j) {
-      for (long i = 0; i < N; ++i) {
-        if (o(j, i) < 0)
-          o(j, i) += M_PI;
-        else if (o(j, i) >= M_PI)
-          o(j, i) -= M_PI;
-      }
+    image_type &gx = ws.gx, &gy = ws.gy;
+    {
+      const stage_timer t(stat_gradient);
+      sobel_gradient(image, gx, gy, r);
     }
 
     // Generate orientational response images.
-    std::vector< image_type > os;
-    orient_responses(g, o, orient_bin_count, os);
+    const stage_timer t(stat_orient);
+    for (long j = r.top; j < r.bottom; ++j) {
+      orient_responses4(&gx(j, r.left), &gy(j, r.left), r.right - r.left,
+        &os[0](j, r.left), &os[1](j, r.left), &os[2](j, r.left),
+        &os[3](j, r.left));
+    }
+    return r;
+  }
+
+  // Extract feature descriptors with a tent engine, flagging each
+  // descriptor whose support in the image is empty.  Such descriptors are
+  // zero, and are the same for every image.  The image may be the one in
+  // the buffers.
+  static void extract(const image_type &image, buffers &ws,
+    std::vector< desc_type > &descs, std::vector< bool > &empty,
+    tent_engine_type engine) {
+    descs.clear();
+    descs.reserve(feature_grid_size * feature_grid_size);
+    empty.clear();
+    empty.reserve(feature_grid_size * feature_grid_size);
+
+    const image_region r = responses(image, ws);
+    std::vector< image_type > &os = ws.os;
 
     // Convolve each orientational response image with a 2D tent function to
-    // accelerate interpolation.
-    for (unsigned int i = 0; i < orient_bin_count; ++i) {
-      conv_tent(os[i]);
-      // Account for slightly negative responses introduced by the FFT.
-      os[i] = abs(os[i]);
+    // accelerate interpolation.  The FFT spreads rounding noise over the
+    // whole image, so descriptors can only be skipped with the box filter.
+    image_region support = { 0, N, 0, N };
+    const bool intra = feature_settings().intra_sketch;
+    stage_timer conv_timer(stat_conv);
+    if (engine == tent_box) {
+      const conv_tent_box< T, N, N > conv(spatial_bin_size);
+      #pragma omp parallel for if(intra)
+      for (unsigned int i = 0; i < orient_bin_count; ++i)
+        conv(os[i], r);
+      if (feature_settings().sparse)
+        support = conv.support(r);
+    }
+    else {
+      // Unless the orientations are split across threads, they are
+      // transformed together as one batch.
+      if (intra) {
+        const conv_fft< T, N, N > &conv = conv_tent();
+        #pragma omp parallel for
+        for (unsigned int i = 0; i < orient_bin_count; ++i)
+          conv(os[i]);
+      }
+      else {
+        conv_tent()(os.data(), os.size());
+      }
+      for (unsigned int i = 0; i < orient_bin_count; ++i) {
+        // Account for slightly negative responses introduced by the FFT.
+        os[i] = abs(os[i]);
+      }
+    }
+    conv_timer.stop();
+
+    // Interleave the orientational responses, so each spatial bin of a
+    // descriptor is a single load.
+    const stage_timer gather_timer(stat_gather);
+    std::vector< T > &il = ws.interleaved;
+    il.resize(padded_size * padded_size * orient_bin_count);
+    for (long j = 0; j < N; ++j) {
+      interleave4(&os[0](j, 0), &os[1](j, 0), &os[2](j, 0), &os[3](j, 0),
+        &il[((j + bin_margin) * padded_size + bin_margin) * orient_bin_count],
+        N);
     }
 
     // Extract feature descriptors on a regular grid.  Orientational response
     // values are binned into a spatial grid centered at each grid point.
-    static const unsigned int dg = N / feature_grid_size;
+    desc_type zero;
+    zero = 0;
+
+    for (unsigned int gv = 0; gv < feature_grid_size; ++gv) {
+      const unsigned int v = grid_offset + gv * grid_step;
+      for (unsigned int gu = 0; gu < feature_grid_size; ++gu) {
+        const unsigned int u = grid_offset + gu * grid_step;
+        // Skip descriptors that sample no part of the support.
+        bool rows = false, cols = false;
+        for (unsigned int t = 0; t < spatial_bin_count; ++t) {
+          const int c =
+            spatial_bin_center(spatial_bin_size, spatial_bin_count, t);
+          const int y = v + c;
+          const int x = u + c;
+          rows = rows || (support.top <= y && y < support.bottom);
+          cols = cols || (support.left <= x && x < support.right);
+        }
+        if (!rows || !cols) {
+          descs.push_back(zero);
+          empty.push_back(true);
+          continue;
+        }
 
-    for (unsigned int v = dg / 2; v < N; v += dg) {
-      for (unsigned int u = dg / 2; u < N; u += dg) {
         desc_type d;
-
-        for (unsigned int i = 0; i < orient_bin_count; ++i) {
-          for (unsigned int t = 0; t < spatial_bin_count; ++t) {
-            // The vertical bin center
-            const int ct = spatial_bin_size / 2 + spatial_bin_size *
-              (t - spatial_bin_count / 2);
-
-            for (unsigned int s = 0; s < spatial_bin_count; ++s) {
-              // The horizontal bin center
-              const int cs = spatial_bin_size / 2 + spatial_bin_size *
-                (s - spatial_bin_count / 2);
-
-              const int y = v + ct;
-              const int x = u + cs;
-              d((i * spatial_bin_count + t) * spatial_bin_count + s) =
-                (0 <= y && y < N && 0 <= x && x < N) ? os[i](y, x) : 0;
-            }
-          }
-        }
+        const T *p = &il[((v + bin_margin) * padded_size + u + bin_margin) *
+          orient_bin_count];
+        const bool nonzero = gather4(p, bin_offsets::values,
+          spatial_bin_count * spatial_bin_count, &d(0));
 
         // Normalize the feature descriptor before adding it to the array.
         descs.push_back(normalize(d));
+        empty.push_back(!nonzero);
       }
     }
   }
 
-private:
+  // Extract feature descriptors with the selected tent engine.
+  static void extract(const image_type &image, buffers &ws,
+    std::vector< desc_type > &descs, std::vector< bool > &empty) {
+    extract(image, ws, descs, empty, feature_settings().tent_engine);
+  }
+
   // A 2D tent function kernel for bilinear interpolation
   static image_type tent_kernel_init() {
     const unsigned int tent_size = 2 * spatial_bin_size + 1;
@@ -135,20 +551,15 @@ private:
     return m;
   }
 
-  static const conv_fft< T, N, N > conv_tent;
+  // The tent convolution is planned on first use, so programs that never
+  // extract features don't pay for planning.
+  static const conv_fft< T, N, N > &conv_tent() {
+    static const conv_fft< T, N, N > conv(tent_kernel_init(),
+      orient_bin_count);
+    return conv;
+  }
 };
 
-template< class T, long N >
-const conv_fft< T, N, N > feature_desc_extractor< T, N >::conv_tent(
-  feature_desc_extractor::tent_kernel_init());
-
-// A helper function for inferring the image type for feature extraction
-template< class T, long N >
-void extract_descriptors(const dlib::matrix< T, N, N > &S,
-  std::vector< typename feature_desc_extractor< T, N >::desc_type > &D) {
-  feature_desc_extractor< T, N >::extract(S, D);
-}
-
 // Quantize a feature descriptor for a vocabulary using the Gaussian distance
 // to each word.
 template< class T, long N, long V >
@@ -174,6 +585,7 @@ void feature_hist(const std::vector< dlib::matrix< T, N, 1 > > &descs,
   dlib::matrix< T, V, 1 > &hist) {
   assert(vocab.size() == V && V > 0);
 
+  const stage_timer t(stat_quantize);
   hist = 0;
 
   for (const auto &desc : descs) {
@@ -187,4 +599,75 @@ void feature_hist(const std::vector< dlib::matrix< T, N, 1 > > &descs,
   hist /= V;
 }
 
+// Generate a feature histogram, reusing the quantization of the zero
+// descriptor for descriptors flagged as empty.  The result is the same as
+// above.
+template< class T, long N, long V >
+void feature_hist(const std::vector< dlib::matrix< T, N, 1 > > &descs,
+  const std::vector< bool > &empty,
+  const std::vector< dlib::matrix< T, N, 1 > > &vocab,
+  dlib::matrix< T, V, 1 > &hist) {
+  assert(vocab.size() == V && V > 0);
+  assert(empty.size() == descs.size());
+
+  const stage_timer t(stat_quantize);
+  dlib::matrix< T, V, 1 > q_empty;
+  {
+    dlib::matrix< T, N, 1 > zero;
+    zero = 0;
+    quantize_desc(zero, vocab, q_empty);
+    q_empty = l1_normalize(q_empty);
+  }
+
+  hist = 0;
+
+  if (!feature_settings().intra_sketch) {
+    for (typename std::vector< bool >::size_type i = 0; i < descs.size();
+      ++i) {
+      if (empty[i]) {
+        hist += q_empty;
+        continue;
+      }
+
+      dlib::matrix< T, V, 1 > q;
+      quantize_desc(descs[i], vocab, q);
+
+      // Normalize the feature distance before accumulating.
+      hist += l1_normalize(q);
+    }
+  }
+  else {
+    // Quantize fixed chunks of the descriptors in parallel and add up the
+    // partial histograms in order, so the result does not depend on the
+    // number of threads.
+    static const long chunk_count = 16;
+    static thread_local std::vector< dlib::matrix< T, V, 1 > > buf;
+    std::vector< dlib::matrix< T, V, 1 > > &parts = buf; // The caller's
+    parts.resize(chunk_count);
+
+    const long count = descs.size();
+    #pragma omp parallel for schedule(dynamic)
+    for (long c = 0; c < chunk_count; ++c) {
+      dlib::matrix< T, V, 1 > &part = parts[c];
+      part = 0;
+      for (long i = count * c / chunk_count;
+        i < count * (c + 1) / chunk_count; ++i) {
+        if (empty[i]) {
+          part += q_empty;
+          continue;
+        }
+
+        dlib::matrix< T, V, 1 > q;
+        quantize_desc(descs[i], vocab, q);
+        part += l1_normalize(q);
+      }
+    }
+
+    for (const auto &part : parts)
+      hist += part;
+  }
+
+  hist /= V;
+}
+
 #endif
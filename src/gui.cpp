@@ -1,12 +1,18 @@
 #include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <cmath>
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <cairomm/context.h>
+#include <glibmm/dispatcher.h>
 #include <gtkmm/actiongroup.h>
 #include <gtkmm/aspectframe.h>
 #include <gtkmm/box.h>
@@ -19,22 +25,40 @@
 #include <gtkmm/window.h>
 #include <sigc++/sigc++.h>
 
+#include "conv.h"
 #include "features.h"
+#include "incremental.h"
 #include "io.h"
+#include "model.h"
+#include "strokes.h"
 #include "svm.h"
 #include "types.h"
 
-struct point {
-  double x, y;
-};
+const int sketch_timeout = 50; // ms
+const int sketch_min_size = 256; // px
+
+// The part of a sketch changed since it was last classified, in unit
+// coordinates
+struct sketch_change {
+  sketch_change() : reset(false), x0(1.0), y0(1.0), x1(0.0), y1(0.0) {
+  }
 
-typedef std::vector< point > path_type;
+  bool empty() const {
+    return x0 > x1 || y0 > y1;
+  }
 
-// The width of a line as a fraction of the size of the image.
-const double line_width = 0.00375;
+  // Add a later change to this one.
+  void merge(const sketch_change &c) {
+    reset = reset || c.reset;
+    x0 = std::min(x0, c.x0);
+    y0 = std::min(y0, c.y0);
+    x1 = std::max(x1, c.x1);
+    y1 = std::max(y1, c.y1);
+  }
 
-const int sketch_timeout = 500; // ms
-const int sketch_min_size = 256; // px
+  bool reset; // The whole sketch was cleared or replaced
+  double x0, y0, x1, y1;
+};
 
 class SketchArea : public Gtk::DrawingArea
 {
@@ -48,33 +72,16 @@ public:
   virtual ~SketchArea() {
   }
 
-  // Draw the current sketch to a matrix, converting it to grayscale.
-  template< class T, long NR, long NC >
-  void draw(dlib::matrix< T, NR, NC > &image) const {
-    Cairo::RefPtr< Cairo::ImageSurface > surface =
-      Cairo::ImageSurface::create(Cairo::FORMAT_RGB24, NC, NR);
-    Cairo::RefPtr< Cairo::Context > cr = Cairo::Context::create(surface);
-
-    cr->set_source_rgb(1.0, 1.0, 1.0);
-    cr->paint();
-
-    cr->scale(NC, NR);
-    draw(cr);
-
-    cr->show_page();
+  // Return the current sketch.
+  const strokes_type &strokes() const {
+    return paths;
+  }
 
-    {
-      const unsigned char *p = surface->get_data();
-      const int stride = surface->get_stride();
-
-      const unsigned char *q = p;
-      for (long j = 0; j < NR; ++j, q = p += stride) {
-        for (long i = 0; i < NC; ++i, q += 4) {
-          // Convert the image to grayscale.
-          image(j, i) = (.299 * q[0] + .587 * q[1] + .114 * q[2]) / 255.;
-        }
-      }
-    }
+  // Return the changes to the sketch since the last call.
+  sketch_change take_change() {
+    const sketch_change c = change;
+    change = sketch_change();
+    return c;
   }
 
   // Scale and center the image to fit the canvas.
@@ -105,6 +112,7 @@ public:
       }
     }
 
+    change.reset = true;
     signal_update.emit();
     invalidate();
   }
@@ -112,6 +120,8 @@ public:
   // Clear the sketch, removing all paths.
   void clear() {
     paths.clear();
+    change = sketch_change();
+    change.reset = true;
     signal_update.emit();
     invalidate();
   }
@@ -130,21 +140,7 @@ protected:
 
   // Draw all paths to a Cairo context.
   void draw(const Cairo::RefPtr< Cairo::Context > &cr) const {
-    cr->set_source_rgb(0.0, 0.0, 0.0);
-    cr->set_line_width(line_width);
-    cr->set_line_cap(Cairo::LINE_CAP_ROUND);
-    cr->set_line_join(Cairo::LINE_JOIN_ROUND);
-
-    for (const auto &path : paths) {
-      if (path.empty())
-        continue;
-
-      path_type::const_iterator it = path.begin();
-      cr->move_to(it->x, it->y);
-      for (; it < path.end(); ++it)
-        cr->line_to(it->x, it->y);
-      cr->stroke();
-    }
+    draw_strokes(cr->cobj(), paths);
   }
 
   virtual bool on_button_press_event(GdkEventButton *event) {
@@ -226,6 +222,11 @@ protected:
 
     path.push_back(p);
 
+    change.x0 = std::min(change.x0, x0 - line_width);
+    change.y0 = std::min(change.y0, y0 - line_width);
+    change.x1 = std::max(change.x1, x1 + line_width);
+    change.y1 = std::max(change.y1, y1 + line_width);
+
     Gdk::Rectangle rect(std::floor((x0 - line_width) * width),
       std::floor((y0 - line_width) * height),
       std::ceil((x1 - x0 + 2 * line_width) * width),
@@ -235,15 +236,254 @@ protected:
     get_window()->invalidate_rect(rect, false);
   }
 
-  std::vector< path_type > paths;
+  strokes_type paths;
+  sketch_change change;
+};
+
+// Classifies a sketch as it is drawn
+class recognizer {
+public:
+  virtual ~recognizer() {
+  }
+
+  // Update the features for the changes to a sketch and return its
+  // predicted category.
+  virtual int update(const strokes_type &strokes,
+    const sketch_change &change) = 0;
+};
+
+// A recognizer that updates the features of the sketch incrementally, for
+// images of N pixels and a vocabulary of V words.  Its features match the
+// box engine only, so it is used for models built with that engine.
+template< long N, long V >
+class incremental_recognizer : public recognizer {
+public:
+  typedef classifier_types< V > types;
+
+  incremental_recognizer(const vocab_type &vocab,
+    std::shared_ptr< const typename types::df_type > df_, bool ova_) :
+    features(new features_type(vocab)), image(new image_type), df(df_),
+    ova(ova_) {
+    *image = 0;
+  }
+
+  virtual int update(const strokes_type &strokes,
+    const sketch_change &change) {
+    rasterize_strokes(strokes, *image);
+
+    if (change.reset) {
+      features->reset();
+      features->update(*image, nonzero_region(*image));
+    }
+    else if (!change.empty()) {
+      // Include a pixel of slack for antialiasing.
+      const image_region r = {
+        static_cast< long >(std::floor(change.y0 * N)) - 1,
+        static_cast< long >(std::ceil(change.y1 * N)) + 1,
+        static_cast< long >(std::floor(change.x0 * N)) - 1,
+        static_cast< long >(std::ceil(change.x1 * N)) + 1
+      };
+      features->update(*image, dilate_region(r, 0, N, N));
+    }
+
+    const bool intra = feature_settings().intra_sketch;
+    return ova ?
+      predict(df->template get< typename types::ova_df_type >(),
+        features->hist(), intra) :
+      predict(df->template get< typename types::ovo_df_type >(),
+        features->hist(), intra);
+  }
+
+private:
+  typedef incremental_features< float, N, V > features_type;
+  typedef typename features_type::image_type image_type;
+
+  std::unique_ptr< features_type > features;
+  std::unique_ptr< image_type > image;
+  std::shared_ptr< const typename types::df_type > df;
+  bool ova;
+};
+
+// A recognizer that extracts the features of the whole sketch on every
+// update with the tent engine of its model, for images of N pixels and a
+// vocabulary of V words
+template< long N, long V >
+class full_recognizer : public recognizer {
+public:
+  typedef classifier_types< V > types;
+
+  full_recognizer(const vocab_type &vocab_,
+    std::shared_ptr< const typename types::df_type > df_, bool ova_,
+    tent_engine_type tent_) :
+    vocab(vocab_), df(df_), ova(ova_), tent(tent_) {
+  }
+
+  virtual int update(const strokes_type &strokes, const sketch_change &) {
+    typename types::hist_type &hist = ws.hist< V >();
+    auto &image = ws.buffers< N >().image;
+    rasterize_strokes(strokes, image);
+    extract_descriptors(image, ws, tent);
+    feature_hist(ws.descs, ws.empty, vocab, hist);
+
+    const bool intra = feature_settings().intra_sketch;
+    return ova ?
+      predict(df->template get< typename types::ova_df_type >(), hist,
+        intra) :
+      predict(df->template get< typename types::ovo_df_type >(), hist,
+        intra);
+  }
+
+private:
+  const vocab_type &vocab;
+  sketch_workspace ws;
+  std::shared_ptr< const typename types::df_type > df;
+  bool ova;
+  tent_engine_type tent;
+};
+
+template< long V >
+struct recognizer_maker {
+  const vocab_type &vocab;
+  std::shared_ptr< const typename classifier_types< V >::df_type > df;
+  bool ova;
+  tent_engine_type tent;
+
+  template< long N >
+  std::unique_ptr< recognizer > operator()(size_tag< N >) const {
+    if (tent == tent_box) {
+      return std::unique_ptr< recognizer >(
+        new incremental_recognizer< N, V >(vocab, df, ova));
+    }
+    return std::unique_ptr< recognizer >(
+      new full_recognizer< N, V >(vocab, df, ova, tent));
+  }
+};
+
+// Load a classifier for a vocabulary of V words, returning a recognizer
+// that uses it.
+struct recognizer_loader {
+  const vocab_type &vocab;
+  model_sizes sizes;
+  const char *cats_path;
+  bool ova;
+
+  template< long V >
+  std::unique_ptr< recognizer > operator()(size_tag< V >) const {
+    typedef typename classifier_types< V >::df_type df_type;
+
+    std::shared_ptr< df_type > df(new df_type);
+    load_classifier< V >(cats_path, sizes, ova, *df);
+
+    const recognizer_maker< V > maker = { vocab, df, ova, sizes.tent };
+    return dispatch_image_size(sizes.image_size, maker);
+  }
+};
+
+// Classifies sketches on a background thread
+//
+// Snapshots of a sketch are submitted from the main loop and classified in
+// the order they were drawn.  Only the latest snapshot waits to be
+// classified: a newer one replaces it, merging their changes, since the
+// recognizer must see every change to keep its features up to date.  The
+// result of a snapshot that was replaced while it was being classified is
+// stale and is dropped.  Each fresh result is announced on the main loop
+// through signal_done.
+class sketch_worker {
+public:
+  explicit sketch_worker(recognizer &rec_) : rec(rec_), pending(false),
+    stopping(false), submitted(0), has_result(false), cat(0),
+    thread([this]() { this->run(); }) {
+  }
+
+  ~sketch_worker() {
+    {
+      std::lock_guard< std::mutex > lock(mutex);
+      stopping = true;
+    }
+    work_ready.notify_one();
+    thread.join();
+  }
+
+  // Queue a snapshot of a sketch for classification.
+  void submit(const strokes_type &strokes, const sketch_change &change) {
+    {
+      std::lock_guard< std::mutex > lock(mutex);
+      next_strokes = strokes;
+      if (pending)
+        next_change.merge(change);
+      else
+        next_change = change;
+      pending = true;
+      ++submitted;
+    }
+    work_ready.notify_one();
+  }
+
+  // Take the latest result, returning false if there is none.
+  bool result(int &cat_) {
+    std::lock_guard< std::mutex > lock(mutex);
+    if (!has_result)
+      return false;
+
+    cat_ = cat;
+    has_result = false;
+    return true;
+  }
+
+  // Emitted on the main loop when a result is ready
+  Glib::Dispatcher signal_done;
+
+private:
+  void run() {
+    strokes_type strokes;
+    sketch_change change;
+    for (;;) {
+      unsigned long id;
+      {
+        std::unique_lock< std::mutex > lock(mutex);
+        work_ready.wait(lock, [&]() { return pending || stopping; });
+        if (stopping)
+          return;
+
+        std::swap(strokes, next_strokes);
+        change = next_change;
+        pending = false;
+        id = submitted;
+      }
+
+      const int c = rec.update(strokes, change);
+
+      {
+        std::lock_guard< std::mutex > lock(mutex);
+        if (id != submitted)
+          continue;
+
+        cat = c;
+        has_result = true;
+      }
+      signal_done.emit();
+    }
+  }
+
+  recognizer &rec;
+
+  std::mutex mutex;
+  std::condition_variable work_ready;
+  strokes_type next_strokes;
+  sketch_change next_change;
+  bool pending, stopping;
+  unsigned long submitted; // The number of snapshots submitted so far
+  bool has_result;
+  int cat;
+
+  std::thread thread;
 };
 
 class MainWindow : public Gtk::Window
 {
 public:
-  MainWindow(const vocab_type *vocab_, const std::map< int, std::string >
-    *cat_map_, bool ova_, df_type *df_) : hbox(true, 10),
-    vocab(vocab_), cat_map(cat_map_), ova(ova_), df(df_) {
+  MainWindow(recognizer *rec, const std::map< int, std::string > *cat_map_) :
+    hbox(true, 10), worker(*rec), cat_map(cat_map_) {
     // Set up the window.
     set_title("Sketch recognition");
     set_size_request(800, 400);
@@ -287,6 +527,9 @@ public:
       &MainWindow::on_sketch_update));
     sketch_frame.add(sketch);
 
+    worker.signal_done.connect(sigc::mem_fun(*this,
+      &MainWindow::on_sketch_classified));
+
     cat_label.set_text("Draw in the box to begin.");
     cat_label.set_justify(Gtk::JUSTIFY_CENTER);
     cat_label.set_line_wrap();
@@ -320,18 +563,14 @@ protected:
   }
 
   virtual bool on_sketch_timeout() {
-    image_type image;
-    sketch.draw(image);
-    image = 1. - image;
-
-    std::vector< feature_desc_type > descs;
-    extract_descriptors(image, descs);
-
-    feature_hist_type hist;
-    feature_hist(descs, *vocab, hist);
+    worker.submit(sketch.strokes(), sketch.take_change());
+    return false;
+  }
 
-    const int cat = ova ? df->get< ova_df_type >()(hist) :
-      df->get< ovo_df_type >()(hist);
+  virtual void on_sketch_classified() {
+    int cat;
+    if (!worker.result(cat))
+      return;
 
     const auto it = cat_map->find(cat);
     assert(it != cat_map->end());
@@ -339,8 +578,6 @@ protected:
     std::ostringstream ss;
     ss << "<span size=\"xx-large\">" << it->second << "</span>";
     cat_label.set_markup(ss.str());
-
-    return false;
   }
 
   sigc::connection sketch_timer_conn;
@@ -351,10 +588,8 @@ protected:
   SketchArea sketch;
   Gtk::Label cat_label;
 
-  const vocab_type *vocab;
+  sketch_worker worker;
   const std::map< int, std::string > *cat_map;
-  bool ova;
-  df_type *df;
 };
 
 int main(int argc, char* argv[])
@@ -367,6 +602,9 @@ int main(int argc, char* argv[])
   const char *cats_path = "cats.out";
   bool ova = true;
 
+  // Plan FFTs cheaply by default, since planning delays the first stroke.
+  fft_settings().flags = FFTW_ESTIMATE;
+
   {
     int i;
     for (i = 1; i < argc; ++i) {
@@ -393,6 +631,26 @@ int main(int argc, char* argv[])
           goto err;
         }
       }
+      else if (!strcmp(argv[i], "--tent")) {
+        if (!set_tent_engine(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--dense")) {
+        feature_settings().sparse = false;
+      }
+      else if (!strcmp(argv[i], "--intra")) {
+        feature_settings().intra_sketch = true;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
       else {
         break;
       }
@@ -411,37 +669,19 @@ int main(int argc, char* argv[])
   {
     // Load the vocabulary.
     vocab_type vocab;
-    {
-      std::ifstream fs(vocab_path, std::ios::binary);
-      deserialize2(vocab, fs);
-    }
+    const model_sizes sizes = load_vocab(vocab_path, vocab);
+    check_model_engine(sizes);
 
     // Load the category map.
     std::map< int, std::string > cat_map;
-    {
-      std::ifstream fs(map_path);
-      for (std::string line; std::getline(fs, line);) {
-        std::istringstream ss(line);
-        int i;
-        std::string label;
-        ss >> i;
-        ss.get(); // ','
-        std::getline(ss, label);
-        cat_map[i] = label;
-      }
-    }
+    load_category_labels(map_path, cat_map);
 
     // Load the category classifier.
-    df_type df;
-    {
-      std::ifstream fs(cats_path, std::ios::binary);
-      if (ova)
-        deserialize2(df.get< ova_df_type >(), fs);
-      else
-        deserialize2(df.get< ovo_df_type >(), fs);
-    }
+    const recognizer_loader loader = { vocab, sizes, cats_path, ova };
+    const std::unique_ptr< recognizer > rec =
+      dispatch_word_count(sizes.word_count, loader);
 
-    MainWindow win(&vocab, &cat_map, ova, &df);
+    MainWindow win(rec.get(), &cat_map);
     app.run(win);
   }
 
@@ -449,7 +689,10 @@ int main(int argc, char* argv[])
 
 usage:
   std::cerr << "Usage: " << argv[0]
-    << " [-v vocab-file] [-m map-file] [-c classifier] [cats-file]\n";
+    << " [-v vocab-file] [-m map-file] [-c classifier]"
+    " [--tent engine] [--dense] [--intra]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]"
+    " [cats-file]\n";
 
 err:
   return 1;
@@ -0,0 +1,246 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <dlib/matrix.h>
+
+#include "conv.h"
+#include "features.h"
+#include "util.h"
+
+// Feature histograms kept up to date as a sketch is drawn
+//
+// Each update of a sketch being drawn changes only a small part of the
+// image.  This keeps the orientational responses, descriptors and quantized
+// descriptors of the last image and recomputes only what a changed region
+// can reach: the gradient and responses next to it, the convolved responses
+// within the reach of the tent kernel, and the grid descriptors that sample
+// those.  The histogram is updated by subtracting the old quantization of
+// each recomputed descriptor and adding the new one.
+//
+// The tent convolution is linear, so the convolved responses are updated by
+// convolving the old and the new responses within the region on their own.
+// Both are non-negative, as conv_tent_box requires.  The results match
+// extraction with the box engine up to rounding.
+//
+// Subtracting and adding leaves rounding error behind.  A convolved response
+// within rounding of zero is snapped to zero, so a cell that was erased is
+// empty again, as with full extraction.  Every refresh_interval updates,
+// the convolved responses and the histogram are recomputed from scratch so
+// the error cannot build up.
+template< class T, long N, long V >
+class incremental_features {
+public:
+  typedef feature_desc_extractor< T, N > extractor_type;
+  typedef typename extractor_type::image_type image_type;
+  typedef typename extractor_type::desc_type desc_type;
+  typedef std::vector< desc_type > vocab_type;
+  typedef dlib::matrix< T, V, 1 > hist_type;
+
+  static const unsigned int refresh_interval = 64;
+
+  explicit incremental_features(const vocab_type &vocab_) : vocab(vocab_),
+    raw(orient_bin_count), conv_out(orient_bin_count),
+    old_part(orient_bin_count), new_part(orient_bin_count) {
+    desc_type zero;
+    zero = 0;
+    quantize_desc(zero, vocab, q_empty);
+    q_empty = l1_normalize(q_empty);
+
+    reset();
+  }
+
+  // Clear the features to those of an empty image.
+  void reset() {
+    for (unsigned int i = 0; i < orient_bin_count; ++i) {
+      raw[i] = 0;
+      conv_out[i] = 0;
+    }
+    il.assign(padded_size * padded_size * orient_bin_count, 0);
+
+    desc_type zero;
+    zero = 0;
+    descs.assign(grid_count * grid_count, zero);
+    empty.assign(grid_count * grid_count, true);
+    qs.assign(grid_count * grid_count, q_empty);
+
+    sum = 0;
+    for (const auto &q : qs)
+      sum += q;
+    hist_ = sum;
+    hist_ /= V;
+    updates = 0;
+  }
+
+  // Update the features for a new image that differs from the last one only
+  // within a region.
+  void update(const image_type &image, const image_region &dirty) {
+    // The gradient changes one pixel beyond the changed pixels.
+    const image_region g = dilate_region(dirty, 1, N, N);
+    if (g.empty())
+      return;
+
+    // Replace the responses in the region, keeping the old and the new ones
+    // in otherwise empty images.
+    sobel_gradient(image, gx, gy, g);
+    for (unsigned int i = 0; i < orient_bin_count; ++i) {
+      old_part[i] = 0;
+      new_part[i] = 0;
+    }
+    const long width = g.right - g.left;
+    for (long j = g.top; j < g.bottom; ++j) {
+      for (unsigned int i = 0; i < orient_bin_count; ++i) {
+        std::copy(&raw[i](j, g.left), &raw[i](j, g.left) + width,
+          &old_part[i](j, g.left));
+      }
+      orient_responses4(&gx(j, g.left), &gy(j, g.left), width,
+        &raw[0](j, g.left), &raw[1](j, g.left), &raw[2](j, g.left),
+        &raw[3](j, g.left));
+      for (unsigned int i = 0; i < orient_bin_count; ++i) {
+        std::copy(&raw[i](j, g.left), &raw[i](j, g.left) + width,
+          &new_part[i](j, g.left));
+      }
+    }
+
+    const conv_tent_box< T, N, N > conv(spatial_bin_size);
+    const bool refresh = ++updates == refresh_interval;
+    image_region s;
+    if (refresh) {
+      // Convolve all of the responses again.
+      updates = 0;
+      #pragma omp parallel for if(feature_settings().intra_sketch)
+      for (unsigned int i = 0; i < orient_bin_count; ++i) {
+        conv_out[i] = raw[i];
+        conv(conv_out[i]);
+      }
+      s = image_region { 0, N, 0, N };
+    }
+    else {
+      // Convolve both and swap the old contribution for the new one.
+      #pragma omp parallel for if(feature_settings().intra_sketch)
+      for (unsigned int k = 0; k < 2 * orient_bin_count; ++k) {
+        if (k < orient_bin_count)
+          conv(old_part[k], g);
+        else
+          conv(new_part[k - orient_bin_count], g);
+      }
+
+      const T tolerance = 8 * std::numeric_limits< T >::epsilon();
+      s = conv.support(g);
+      for (unsigned int i = 0; i < orient_bin_count; ++i) {
+        for (long j = s.top; j < s.bottom; ++j) {
+          for (long x = s.left; x < s.right; ++x) {
+            const T c = conv_out[i](j, x), o = old_part[i](j, x),
+              n = new_part[i](j, x);
+            const T r = c - o + n;
+            conv_out[i](j, x) = r > tolerance * (c + o + n) ? r : T(0);
+          }
+        }
+      }
+    }
+
+    for (long j = s.top; j < s.bottom; ++j) {
+      interleave4(&conv_out[0](j, s.left), &conv_out[1](j, s.left),
+        &conv_out[2](j, s.left), &conv_out[3](j, s.left),
+        &il[((j + bin_margin) * padded_size + bin_margin + s.left) *
+        orient_bin_count], s.right - s.left);
+    }
+
+    // Recompute the descriptors that sample the changed responses.
+    for (long gv = 0; gv < grid_count; ++gv) {
+      const long v = grid_offset + gv * grid_step;
+      if (!samples(v, s.top, s.bottom))
+        continue;
+
+      for (long gu = 0; gu < grid_count; ++gu) {
+        const long u = grid_offset + gu * grid_step;
+        if (!samples(u, s.left, s.right))
+          continue;
+
+        const long k = gv * grid_count + gu;
+        desc_type d;
+        const T *p = &il[((v + bin_margin) * padded_size + u + bin_margin) *
+          orient_bin_count];
+        const bool nonzero = gather4(p,
+          extractor_type::bin_offsets::values,
+          spatial_bin_count * spatial_bin_count, &d(0));
+        descs[k] = normalize(d);
+        empty[k] = !nonzero;
+
+        hist_type q;
+        if (nonzero) {
+          quantize_desc(descs[k], vocab, q);
+          q = l1_normalize(q);
+        }
+        else {
+          q = q_empty;
+        }
+        sum += q - qs[k];
+        qs[k] = q;
+      }
+    }
+
+    if (refresh) {
+      sum = 0;
+      for (const auto &q : qs)
+        sum += q;
+    }
+
+    hist_ = sum;
+    hist_ /= V;
+  }
+
+  const std::vector< desc_type > &descriptors() const {
+    return descs;
+  }
+
+  const hist_type &hist() const {
+    return hist_;
+  }
+
+private:
+  static const unsigned int orient_bin_count =
+    extractor_type::orient_bin_count;
+  static const unsigned int spatial_bin_count =
+    extractor_type::spatial_bin_count;
+  static const unsigned int spatial_bin_size =
+    extractor_type::spatial_bin_size;
+  static const int bin_margin = extractor_type::bin_margin;
+  static const long padded_size = extractor_type::padded_size;
+
+  // The descriptor grid, as in feature_desc_extractor::extract
+  static const long grid_count = extractor_type::feature_grid_size;
+  static const long grid_step = extractor_type::grid_step;
+  static const long grid_offset = extractor_type::grid_offset;
+
+  // Return whether a grid coordinate has a spatial bin center in [lo, hi).
+  static bool samples(long w, long lo, long hi) {
+    for (unsigned int t = 0; t < spatial_bin_count; ++t) {
+      const long c = w +
+        spatial_bin_center(spatial_bin_size, spatial_bin_count, t);
+      if (lo <= c && c < hi)
+        return true;
+    }
+    return false;
+  }
+
+  const vocab_type &vocab;
+
+  image_type gx, gy; // The gradient within the last changed region
+  std::vector< image_type > raw; // The orientational responses
+  std::vector< image_type > conv_out; // The convolved responses
+  std::vector< image_type > old_part, new_part;
+  std::vector< T > il; // The convolved responses, interleaved and padded
+
+  std::vector< desc_type > descs;
+  std::vector< bool > empty;
+  std::vector< hist_type > qs; // The quantization of each descriptor
+  hist_type q_empty; // The quantization of the zero descriptor
+  hist_type sum, hist_;
+  unsigned int updates; // Updates since the last recomputation
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "input.h"
+#include "zip.h"
+
+namespace {
+
+const unsigned int fold_count = 8;
+
+// Return the name of the parent directory of a path.
+std::string parent_name(const std::string &path) {
+  const std::size_t dir_end = path.rfind('/');
+  if (dir_end == std::string::npos || dir_end == 0)
+    return std::string();
+
+  std::size_t dir_begin = path.rfind('/', dir_end - 1);
+  if (dir_begin == std::string::npos)
+    dir_begin = 0;
+  else
+    ++dir_begin;
+
+  return path.substr(dir_begin, dir_end - dir_begin);
+}
+
+// Return the numeric value of the file name of a path.
+long file_number(const std::string &path) {
+  const std::size_t name_begin = path.rfind('/');
+  return std::strtol(path.c_str() +
+    ((name_begin == std::string::npos) ? 0 : name_begin + 1), nullptr, 10);
+}
+
+// Check whether a path ends with an extension.
+bool has_extension(const std::string &path, const std::string &ext) {
+  return path.size() >= ext.size() &&
+    path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// Check whether a path names an SVG image.
+bool is_svg(const std::string &path) {
+  return has_extension(path, ".svg");
+}
+
+}
+
+bool is_strokes_path(const std::string &path) {
+  return has_extension(path, ".strokes");
+}
+
+void sketch_source::open_archive(const char *path) {
+  archive.reset(new zip_archive(path));
+}
+
+void sketch_source::open_pack(const char *path, long image_size) {
+  pack.reset(new image_pack(path));
+  if (pack->image_size() != image_size)
+    throw pack_size_error();
+}
+
+void sketch_source::read_paths(std::istream &s) {
+  for (std::string path; std::getline(s, path);)
+    paths.push_back(path);
+}
+
+void sketch_source::select(const char *fold_id, const char *category) {
+  if (!archive && !pack)
+    throw input_error();
+
+  // Parse the fold identifier, which may be negated with `~'.
+  bool negate = false;
+  unsigned int fold = 0;
+  if (fold_id) {
+    std::istringstream ss(fold_id);
+    if (ss.peek() == '~') {
+      negate = true;
+      ss.get();
+    }
+    if (!(ss >> fold) || !ss.eof() || fold >= fold_count)
+      throw input_error();
+  }
+
+  // Order the entries by file number, keeping track of their positions in
+  // the pack.
+  typedef std::pair< long, std::pair< std::string, image_pack::size_type > >
+    numbered_type;
+  std::vector< numbered_type > numbered;
+  if (pack) {
+    for (image_pack::size_type i = 0; i < pack->size(); ++i) {
+      numbered.push_back(numbered_type(file_number(pack->name(i)),
+        std::make_pair(pack->name(i), i)));
+    }
+  }
+  else {
+    for (const auto &entry : archive->entries()) {
+      if (is_svg(entry.name) || is_strokes_path(entry.name)) {
+        numbered.push_back(numbered_type(file_number(entry.name),
+          std::make_pair(entry.name, 0)));
+      }
+    }
+  }
+  std::sort(numbered.begin(), numbered.end());
+
+  for (std::vector< numbered_type >::size_type i = 0; i < numbered.size();
+    ++i) {
+    const std::string &name = numbered[i].second.first;
+    if (fold_id && (i % fold_count == fold) == negate)
+      continue;
+    if (category && (pack ? pack->label(numbered[i].second.second) :
+      parent_name(name)) != category)
+      continue;
+    paths.push_back(name);
+    if (pack)
+      pack_indices.push_back(numbered[i].second.second);
+  }
+}
+
+std::string sketch_source::category(size_type i) const {
+  return pack ? pack->label(pack_indices[i]) : parent_name(paths[i]);
+}
+
+void sketch_source::read(size_type i, std::vector< char > &data) const {
+  data.clear();
+  if (pack)
+    return;
+
+  if (archive) {
+    const zip_entry *entry = archive->find(paths[i]);
+    if (!entry)
+      throw input_error();
+    archive->extract(*entry, data);
+  }
+  else {
+    std::ifstream fs(paths[i], std::ios::binary);
+    if (!fs)
+      throw input_error();
+    data.assign(std::istreambuf_iterator< char >(fs),
+      std::istreambuf_iterator< char >());
+  }
+}
@@ -0,0 +1,150 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <exception>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dlib/matrix.h>
+
+#include "pack.h"
+#include "strokes.h"
+#include "svg.h"
+#include "zip.h"
+
+// An error while selecting input sketches
+struct input_error : std::exception {
+  virtual ~input_error() noexcept {
+  }
+
+  virtual const char *what() const noexcept {
+    return "input error";
+  }
+};
+
+// Return whether a path names a sketch stored as strokes rather than as SVG.
+bool is_strokes_path(const std::string &path);
+
+// A list of sketches to process
+//
+// Sketches are SVG or stroke files on disk, entries in a zip archive of the
+// dataset, or pre-rasterized images in an image pack.  Stroke files end in
+// `.strokes' and may be in either stroke format.  Archive entries are named
+// by their path within the archive, so the category of each sketch is still
+// the name of its parent directory.
+class sketch_source {
+public:
+  typedef std::vector< std::string >::size_type size_type;
+
+  // Read sketches from a zip archive instead of from individual files.
+  void open_archive(const char *path);
+
+  // Read all images from an image pack instead of rasterizing SVG files.
+  // Unless a selection is made, every image in the pack is used.  Throws
+  // pack_size_error unless the images are image_size pixels square, so a
+  // mismatch is reported before any extraction starts.
+  void open_pack(const char *path, long image_size);
+
+  // Read paths from a stream, one per line.
+  void read_paths(std::istream &s);
+
+  // Select archive or pack entries by fold (e.g. "3" or "~3") and by category.
+  // Either criterion may be null to select entries regardless of it.
+  // Entries are assigned to folds in numeric order of their file names,
+  // matching the assignment made by util/data-fold.
+  void select(const char *fold_id, const char *category);
+
+  size_type size() const {
+    return paths.size();
+  }
+
+  const std::string &path(size_type i) const {
+    return paths[i];
+  }
+
+  // Return the category label of a sketch.
+  std::string category(size_type i) const;
+
+  // Load and rasterize a sketch.
+  template< class T, long N >
+  void load(size_type i, dlib::matrix< T, N, N > &image) const {
+    if (pack)
+      pack->load(pack_indices[i], image);
+    else
+      load(paths[i], image);
+  }
+
+  // Read the stored data of a sketch without decoding it, so reading and
+  // rasterizing may be done on different threads.  Images in a pack are
+  // decoded straight from the mapped file, so they have no data to read.
+  void read(size_type i, std::vector< char > &data) const;
+
+  // Rasterize a sketch from the data read for it.
+  template< class T, long N >
+  void rasterize(size_type i, const std::vector< char > &data,
+    dlib::matrix< T, N, N > &image) const {
+    if (pack)
+      pack->load(pack_indices[i], image);
+    else if (is_strokes_path(paths[i]))
+      load_strokes(data.data(), data.size(), image);
+    else
+      load_svg(data.data(), data.size(), image);
+  }
+
+  // Load and rasterize a sketch that is not in the list, naming either a file
+  // or an archive entry.
+  template< class T, long N >
+  void load(const std::string &path, dlib::matrix< T, N, N > &image) const {
+    if (archive) {
+      const zip_entry *entry = archive->find(path);
+      if (!entry)
+        throw input_error();
+
+      static thread_local std::vector< char > data;
+      archive->extract(*entry, data);
+      if (is_strokes_path(path))
+        load_strokes(data.data(), data.size(), image);
+      else
+        load_svg(data.data(), data.size(), image);
+    }
+    else if (is_strokes_path(path)) {
+      load_strokes(path.c_str(), image);
+    }
+    else {
+      load_svg(path.c_str(), image);
+    }
+  }
+
+private:
+  std::unique_ptr< zip_archive > archive;
+  std::unique_ptr< image_pack > pack;
+  std::vector< std::string > paths;
+  std::vector< image_pack::size_type > pack_indices;
+};
+
+// A callable that loads one sketch of a source, by index or by path, into an
+// image of any size
+template< class Key >
+struct sketch_loader {
+  sketch_loader(const sketch_source &sketches_, const Key &key_) :
+    sketches(sketches_), key(key_) {
+  }
+
+  template< class T, long N >
+  void operator()(dlib::matrix< T, N, N > &image) const {
+    sketches.load(key, image);
+  }
+
+  const sketch_source &sketches;
+  Key key;
+};
+
+template< class Key >
+sketch_loader< Key > make_loader(const sketch_source &sketches,
+  const Key &key) {
+  return sketch_loader< Key >(sketches, key);
+}
+
+#endif
@@ -0,0 +1,34 @@
+#include <cstddef>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+bool mapped_file::open(const char *path) {
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+
+  void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  base = static_cast< const unsigned char * >(p);
+  length = st.st_size;
+  return true;
+}
+
+mapped_file::~mapped_file() {
+  if (base)
+    munmap(const_cast< unsigned char * >(base), length);
+}
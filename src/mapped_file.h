@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+// A read-only file mapped into memory
+class mapped_file {
+public:
+  mapped_file() : base(nullptr), length(0) {
+  }
+
+  ~mapped_file();
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  // Map a file, returning false on failure.
+  bool open(const char *path);
+
+  const unsigned char *data() const {
+    return base;
+  }
+
+  std::size_t size() const {
+    return length;
+  }
+
+private:
+  const unsigned char *base;
+  std::size_t length;
+};
+
+#endif
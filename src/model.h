@@ -0,0 +1,351 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "features.h"
+#include "io.h"
+#include "stats.h"
+#include "types.h"
+
+// Image and vocabulary sizes chosen at run time
+//
+// The extractor and the quantizer are specialized on the image size and the
+// vocabulary size, so their loops and bin offsets are fixed at compile time.
+// Each supported size is instantiated once, and the sizes recorded in the
+// vocabulary and classifier files select an instantiation when they are
+// loaded.
+
+// An unsupported or inconsistent image or vocabulary size
+struct size_error : std::exception {
+  virtual ~size_error() noexcept {
+  }
+
+  virtual const char *what() const noexcept {
+    return "unsupported or mismatched model size";
+  }
+};
+
+// A model built with a different tent engine than the one selected
+struct engine_error : std::exception {
+  virtual ~engine_error() noexcept {
+  }
+
+  virtual const char *what() const noexcept {
+    return "the model was built with a different tent engine";
+  }
+};
+
+// The sizes and the tent engine a vocabulary or classifier was built for
+struct model_sizes {
+  long image_size;
+  long word_count;
+  tent_engine_type tent;
+};
+
+// Files written before the sizes were recorded have these sizes, and were
+// built with the FFT engine.
+const model_sizes legacy_sizes = { 256, 500, tent_fft };
+
+// Vocabulary and classifier files start with a magic number, a version, the
+// model sizes and, since version 2, the tent engine.  Older files start with
+// an element count instead, which never equals the magic number.  Version 1
+// files were built with the FFT engine, the only default there has been.
+const std::uint64_t model_magic = 0x6372686374656b73; // "sketchrc"
+const std::uint32_t model_version = 2;
+
+static_assert(std::is_same< feature_desc_type,
+  feature_desc_extractor< float, 128 >::desc_type >::value &&
+  std::is_same< feature_desc_type,
+  feature_desc_extractor< float, 192 >::desc_type >::value,
+  "descriptors must not depend on the image size");
+
+inline bool supported_image_size(long n) {
+  return n == 128 || n == 192 || n == 256;
+}
+
+inline bool supported_word_count(long v) {
+  return v == 250 || v == 500 || v == 1000 || v == 2000;
+}
+
+// A size known at compile time
+template< long N >
+struct size_tag {
+  static const long value = N;
+};
+
+// Call f with the tag of a supported image size.
+template< class F >
+auto dispatch_image_size(long n, F f) -> decltype(f(size_tag< 256 >())) {
+  switch (n) {
+  case 128:
+    return f(size_tag< 128 >());
+  case 192:
+    return f(size_tag< 192 >());
+  case 256:
+    return f(size_tag< 256 >());
+  default:
+    throw size_error();
+  }
+}
+
+// Call f with the tag of a supported vocabulary size.
+template< class F >
+auto dispatch_word_count(long v, F f) -> decltype(f(size_tag< 500 >())) {
+  switch (v) {
+  case 250:
+    return f(size_tag< 250 >());
+  case 500:
+    return f(size_tag< 500 >());
+  case 1000:
+    return f(size_tag< 1000 >());
+  case 2000:
+    return f(size_tag< 2000 >());
+  default:
+    throw size_error();
+  }
+}
+
+// Write the header of a vocabulary or classifier file.
+inline void write_model_header(std::ostream &s, const model_sizes &sizes) {
+  serialize2(model_magic, s);
+  serialize2(model_version, s);
+  serialize2(sizes.image_size, s);
+  serialize2(sizes.word_count, s);
+  serialize2(static_cast< std::uint32_t >(sizes.tent), s);
+}
+
+// Read the header of a vocabulary or classifier file, leaving the stream at
+// the start of the data.  Files without a header have the legacy sizes.
+inline model_sizes read_model_header(std::istream &s) {
+  const std::istream::pos_type start = s.tellg();
+  std::uint64_t magic;
+  deserialize2(magic, s);
+  if (magic != model_magic) {
+    if (!s.seekg(start))
+      throw serialization_error();
+    return legacy_sizes;
+  }
+
+  std::uint32_t version;
+  deserialize2(version, s);
+  if (version < 1 || version > model_version)
+    throw serialization_error();
+
+  model_sizes sizes;
+  deserialize2(sizes.image_size, s);
+  deserialize2(sizes.word_count, s);
+  if (!supported_image_size(sizes.image_size) ||
+    !supported_word_count(sizes.word_count))
+    throw size_error();
+
+  sizes.tent = tent_fft;
+  if (version >= 2) {
+    std::uint32_t tent;
+    deserialize2(tent, s);
+    if (tent != tent_fft && tent != tent_box)
+      throw serialization_error();
+    sizes.tent = static_cast< tent_engine_type >(tent);
+  }
+  return sizes;
+}
+
+// Save a vocabulary with its sizes.
+inline void save_vocab(const char *path, const model_sizes &sizes,
+  const vocab_type &vocab) {
+  std::ofstream fs(path, std::ios::binary);
+  write_model_header(fs, sizes);
+  serialize2(vocab, fs);
+}
+
+// Load a vocabulary, returning the sizes it was built for.
+inline model_sizes load_vocab(const char *path, vocab_type &vocab) {
+  std::ifstream fs(path, std::ios::binary);
+  const model_sizes sizes = read_model_header(fs);
+  deserialize2(vocab, fs);
+  if (static_cast< long >(vocab.size()) != sizes.word_count)
+    throw size_error();
+  return sizes;
+}
+
+// Save a classifier with the sizes of its vocabulary.
+template< long V >
+void save_classifier(const char *path, const model_sizes &sizes, bool ova,
+  const typename classifier_types< V >::df_type &df) {
+  typedef classifier_types< V > types;
+  std::ofstream fs(path, std::ios::binary);
+  write_model_header(fs, sizes);
+  if (ova)
+    serialize2(df.template get< typename types::ova_df_type >(), fs);
+  else
+    serialize2(df.template get< typename types::ovo_df_type >(), fs);
+}
+
+// Load a classifier, checking that it was built for the given sizes.
+template< long V >
+void load_classifier(const char *path, const model_sizes &sizes, bool ova,
+  typename classifier_types< V >::df_type &df) {
+  typedef classifier_types< V > types;
+  std::ifstream fs(path, std::ios::binary);
+  const model_sizes file_sizes = read_model_header(fs);
+  if (file_sizes.image_size != sizes.image_size ||
+    file_sizes.word_count != sizes.word_count || sizes.word_count != V)
+    throw size_error();
+  if (file_sizes.tent != sizes.tent)
+    throw engine_error();
+  if (ova)
+    deserialize2(df.template get< typename types::ova_df_type >(), fs);
+  else
+    deserialize2(df.template get< typename types::ovo_df_type >(), fs);
+}
+
+// Throw engine_error if a tent engine other than the one a model was built
+// with was chosen explicitly.  Features for the model are extracted with its
+// own engine regardless.
+inline void check_model_engine(const model_sizes &sizes) {
+  const feature_options &opts = feature_settings();
+  if (opts.tent_engine_set && opts.tent_engine != sizes.tent)
+    throw engine_error();
+}
+
+// Load a category map, one `id,label' pair per line, calling add(id, label)
+// for each category.
+template< class Add >
+void read_category_map(const char *path, Add add) {
+  std::ifstream fs(path);
+  for (std::string line; std::getline(fs, line);) {
+    std::istringstream ss(line);
+    int i;
+    std::string label;
+    ss >> i;
+    ss.get(); // ','
+    std::getline(ss, label);
+    add(i, label);
+  }
+}
+
+// Load a category map indexed by category id.
+inline void load_category_labels(const char *path,
+  std::map< int, std::string > &cat_map) {
+  read_category_map(path, [&](int i, const std::string &label) {
+    cat_map[i] = label;
+  });
+}
+
+// Load a category map indexed by category label.
+inline void load_category_ids(const char *path,
+  std::map< std::string, int > &cat_map) {
+  read_category_map(path, [&](int i, const std::string &label) {
+    cat_map[label] = i;
+  });
+}
+
+// Buffers for processing one sketch at an image size chosen at run time
+//
+// Buffers for processing one sketch, from its image to its histogram
+//
+// The image and the intermediate results of extraction depend on the image
+// size, and the histogram on the vocabulary size, so those are allocated on
+// first use at each size.  Descriptors have the same type for every image
+// size.  Each thread keeps one workspace for its lifetime, so processing a
+// stream of sketches reuses the same memory and never puts an image on the
+// stack.
+class sketch_workspace {
+public:
+  // Return the image and extraction buffers for images of N pixels.
+  template< long N >
+  typename feature_desc_extractor< float, N >::buffers &buffers() {
+    return sized< typename feature_desc_extractor< float, N >::buffers >(
+      sized_buffers, N);
+  }
+
+  // Return the histogram for a vocabulary of V words.
+  template< long V >
+  dlib::matrix< float, V, 1 > &hist() {
+    return sized< dlib::matrix< float, V, 1 > >(hists, V);
+  }
+
+  std::vector< feature_desc_type > descs;
+  std::vector< bool > empty; // Flags for descriptors with empty support
+
+  // The best categories and their scores, for classifiers that rank them
+  std::vector< std::pair< int, float > > scores;
+
+  // Return the workspace for the calling thread.
+  static sketch_workspace &local() {
+    static thread_local std::unique_ptr< sketch_workspace > ws(
+      new sketch_workspace);
+    return *ws;
+  }
+
+private:
+  template< class B >
+  static B &sized(std::map< long, std::shared_ptr< void > > &m, long size) {
+    std::shared_ptr< void > &p = m[size];
+    if (!p)
+      p = std::make_shared< B >();
+    return *static_cast< B * >(p.get());
+  }
+
+  std::map< long, std::shared_ptr< void > > sized_buffers, hists;
+};
+
+// Extract the descriptors of an image of N pixels into a workspace with a
+// tent engine.  The image may be the one in the workspace.
+template< long N >
+void extract_descriptors(const dlib::matrix< float, N, N > &image,
+  sketch_workspace &ws, tent_engine_type engine) {
+  feature_desc_extractor< float, N >::extract(image, ws.buffers< N >(),
+    ws.descs, ws.empty, engine);
+}
+
+// Extract the descriptors of an image with the selected tent engine.
+template< long N >
+void extract_descriptors(const dlib::matrix< float, N, N > &image,
+  sketch_workspace &ws) {
+  extract_descriptors(image, ws, feature_settings().tent_engine);
+}
+
+template< class Load >
+struct extract_sized_op {
+  extract_sized_op(const Load &load_, tent_engine_type engine_,
+    sketch_workspace &ws_) : load(load_), engine(engine_), ws(ws_) {
+  }
+
+  template< long N >
+  void operator()(size_tag< N >) const {
+    auto &image = ws.buffers< N >().image;
+    {
+      const stage_timer t(stat_rasterize);
+      load(image);
+    }
+    extract_descriptors(image, ws, engine);
+  }
+
+  const Load &load;
+  tent_engine_type engine;
+  sketch_workspace &ws;
+};
+
+// Rasterize a sketch at the image size of a model and extract its
+// descriptors into a workspace with the model's tent engine.  load is called
+// with a square matrix of that size.
+template< class Load >
+void extract_sized(const model_sizes &sizes, const Load &load,
+  sketch_workspace &ws) {
+  dispatch_image_size(sizes.image_size,
+    extract_sized_op< Load >(load, sizes.tent, ws));
+}
+
+#endif
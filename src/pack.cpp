@@ -0,0 +1,187 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "pack.h"
+
+namespace {
+
+// File layout:
+//
+//   header: magic, version, image size, image count, index offset
+//   images: for each image, a run count, (start, length) pairs for each run,
+//     and the pixel intensities of all runs
+//   index: for each image, its offset, name, and label
+const char magic[4] = { 'S', 'K', 'P', 'K' };
+const std::uint32_t version = 1;
+const std::size_t header_size = 24;
+
+template< class T >
+void write_value(std::ofstream &fs, const T &x) {
+  if (!fs.write(reinterpret_cast< const char * >(&x), sizeof(T)))
+    throw pack_error();
+}
+
+void write_string(std::ofstream &fs, const std::string &x) {
+  write_value(fs, static_cast< std::uint32_t >(x.size()));
+  if (!fs.write(x.data(), x.size()))
+    throw pack_error();
+}
+
+// A bounds-checked reader for the mapped file
+struct reader {
+  const unsigned char *p, *end;
+
+  template< class T >
+  T value() {
+    if (static_cast< std::size_t >(end - p) < sizeof(T))
+      throw pack_error();
+    T x;
+    std::memcpy(&x, p, sizeof(T));
+    p += sizeof(T);
+    return x;
+  }
+
+  std::string string() {
+    const std::uint32_t size = value< std::uint32_t >();
+    if (static_cast< std::size_t >(end - p) < size)
+      throw pack_error();
+    std::string x(reinterpret_cast< const char * >(p), size);
+    p += size;
+    return x;
+  }
+};
+
+}
+
+image_pack::image_pack(const char *path) {
+  if (!file.open(path) || file.size() < header_size ||
+    std::memcmp(file.data(), magic, sizeof(magic)))
+    throw pack_error();
+
+  reader r = { file.data() + sizeof(magic), file.data() + file.size() };
+  if (r.value< std::uint32_t >() != version)
+    throw pack_error();
+  size_ = r.value< std::uint32_t >();
+  const std::uint32_t count = r.value< std::uint32_t >();
+  const std::uint64_t index_offset = r.value< std::uint64_t >();
+  if (index_offset > file.size())
+    throw pack_error();
+
+  offsets.reserve(count);
+  names.reserve(count);
+  labels.reserve(count);
+
+  r.p = file.data() + index_offset;
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const std::uint64_t offset = r.value< std::uint64_t >();
+    if (offset < header_size || offset >= index_offset)
+      throw pack_error();
+    offsets.push_back(offset);
+    names.push_back(r.string());
+    labels.push_back(r.string());
+  }
+}
+
+void image_pack::decode(size_type i, unsigned char *pixels) const {
+  const std::size_t n = size_ * size_;
+  std::memset(pixels, 0, n);
+
+  reader r = { file.data() + offsets[i], file.data() + file.size() };
+  const std::uint32_t run_count = r.value< std::uint32_t >();
+
+  // Check the sizes before using them, so a corrupt pack cannot overflow
+  // the arithmetic.
+  const unsigned char *runs = r.p;
+  if (run_count > static_cast< std::size_t >(r.end - runs) /
+    (2 * sizeof(std::uint32_t)))
+    throw pack_error();
+  const unsigned char *q = runs + run_count * 2 * sizeof(std::uint32_t);
+
+  for (std::uint32_t k = 0; k < run_count; ++k) {
+    r.p = runs + k * 2 * sizeof(std::uint32_t);
+    const std::uint32_t start = r.value< std::uint32_t >();
+    const std::uint32_t length = r.value< std::uint32_t >();
+    if (start > n || length > n - start ||
+      length > static_cast< std::size_t >(r.end - q))
+      throw pack_error();
+
+    std::memcpy(pixels + start, q, length);
+    q += length;
+  }
+}
+
+image_pack_writer::image_pack_writer(const char *path, long image_size)
+  : fs(path, std::ios::binary), size_(image_size) {
+  // Reserve space for the header.
+  const char header[header_size] = {};
+  if (!fs.write(header, header_size))
+    throw pack_error();
+}
+
+image_pack_writer::~image_pack_writer() {
+  if (fs.is_open()) {
+    try {
+      close();
+    }
+    catch (const pack_error &) {
+    }
+  }
+}
+
+void image_pack_writer::add(const std::string &name, const std::string &label,
+  const unsigned char *pixels) {
+  offsets.push_back(fs.tellp());
+  names.push_back(name);
+  labels.push_back(label);
+
+  // Find the runs of inked pixels.
+  const std::uint32_t n = size_ * size_;
+  std::vector< std::uint32_t > runs;
+  for (std::uint32_t k = 0; k < n;) {
+    if (!pixels[k]) {
+      ++k;
+      continue;
+    }
+
+    const std::uint32_t start = k;
+    while (k < n && pixels[k])
+      ++k;
+    runs.push_back(start);
+    runs.push_back(k - start);
+  }
+
+  write_value(fs, static_cast< std::uint32_t >(runs.size() / 2));
+  for (const auto &x : runs)
+    write_value(fs, x);
+  for (std::vector< std::uint32_t >::size_type k = 0; k < runs.size(); k += 2) {
+    if (!fs.write(reinterpret_cast< const char * >(pixels + runs[k]),
+      runs[k + 1]))
+      throw pack_error();
+  }
+}
+
+void image_pack_writer::close() {
+  const std::uint64_t index_offset = fs.tellp();
+  for (std::vector< std::uint64_t >::size_type i = 0; i < offsets.size();
+    ++i) {
+    write_value(fs, offsets[i]);
+    write_string(fs, names[i]);
+    write_string(fs, labels[i]);
+  }
+
+  fs.seekp(0);
+  if (!fs.write(magic, sizeof(magic)))
+    throw pack_error();
+  write_value(fs, version);
+  write_value(fs, static_cast< std::uint32_t >(size_));
+  write_value(fs, static_cast< std::uint32_t >(offsets.size()));
+  write_value(fs, index_offset);
+
+  fs.close();
+  if (!fs)
+    throw pack_error();
+}
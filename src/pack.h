@@ -0,0 +1,141 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <dlib/matrix.h>
+
+#include "mapped_file.h"
+#include "util.h"
+
+// An error while reading or writing an image pack
+struct pack_error : std::exception {
+  virtual ~pack_error() noexcept {
+  }
+
+  virtual const char *what() const noexcept {
+    return "pack error";
+  }
+};
+
+// An image pack rasterized at a different size than the one being extracted
+struct pack_size_error : std::exception {
+  virtual ~pack_size_error() noexcept {
+  }
+
+  virtual const char *what() const noexcept {
+    return "the image pack was rasterized at a different image size than "
+      "the vocabulary";
+  }
+};
+
+// A file of pre-rasterized sketches with their names and category labels
+//
+// Each image is stored as runs of inked pixels with 8-bit intensities, since
+// sketches are mostly blank.  The file is mapped into memory and images are
+// decoded on demand, so loading may be called concurrently from multiple
+// threads.
+class image_pack {
+public:
+  typedef std::vector< std::string >::size_type size_type;
+
+  explicit image_pack(const char *path);
+
+  image_pack(const image_pack &) = delete;
+  image_pack &operator=(const image_pack &) = delete;
+
+  // Return the width (and height) of each image.
+  long image_size() const {
+    return size_;
+  }
+
+  size_type size() const {
+    return names.size();
+  }
+
+  const std::string &name(size_type i) const {
+    return names[i];
+  }
+
+  const std::string &label(size_type i) const {
+    return labels[i];
+  }
+
+  // Decode an image into a buffer of ink intensities, where 0 is blank.
+  void decode(size_type i, unsigned char *pixels) const;
+
+  // Load an image, storing its ink coverage in a square matrix as load_svg
+  // does.
+  template< class T, long N >
+  void load(size_type i, dlib::matrix< T, N, N > &image) const {
+    if (N != size_)
+      throw pack_error();
+
+    static thread_local std::vector< unsigned char > pixels;
+    pixels.resize(N * N);
+    decode(i, pixels.data());
+
+    for (long j = 0; j < N; ++j)
+      unit_from_u8(&pixels[j * N], &image(j, 0), N);
+  }
+
+private:
+  mapped_file file;
+  long size_;
+
+  std::vector< std::size_t > offsets;
+  std::vector< std::string > names, labels;
+};
+
+// A writer for image packs
+//
+// Images are written in the order they are added.
+class image_pack_writer {
+public:
+  image_pack_writer(const char *path, long image_size);
+  ~image_pack_writer();
+
+  image_pack_writer(const image_pack_writer &) = delete;
+  image_pack_writer &operator=(const image_pack_writer &) = delete;
+
+  // Add an image of ink intensities, where 0 is blank.
+  void add(const std::string &name, const std::string &label,
+    const unsigned char *pixels);
+
+  // Add an image of ink coverage as stored by load_svg.
+  template< class T, long N >
+  void add(const std::string &name, const std::string &label,
+    const dlib::matrix< T, N, N > &image) {
+    if (N != size_)
+      throw pack_error();
+
+    std::vector< unsigned char > pixels(N * N);
+    unsigned char *p = pixels.data();
+    for (long j = 0; j < N; ++j) {
+      for (long i = 0; i < N; ++i, ++p) {
+        const T v = std::round(image(j, i) * 255.);
+        *p = (v < 0) ? 0 : (v > 255) ? 255 : static_cast< unsigned char >(v);
+      }
+    }
+
+    add(name, label, pixels.data());
+  }
+
+  // Write the index and close the file.
+  void close();
+
+private:
+  std::ofstream fs;
+  long size_;
+
+  std::vector< std::uint64_t > offsets;
+  std::vector< std::string > names, labels;
+};
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "queue.h"
+
+// A chain of stages with separate worker pools, connected by bounded queues
+//
+// Each item read from a source passes through every stage in turn.  A stage
+// is run by its own pool of threads, which take items from the queue in
+// front of the stage and put them in the queue behind it, so a stage that
+// waits on I/O and a stage that computes run at once without taking each
+// other's threads.  A full queue blocks the stage in front of it, so a slow
+// stage holds back the stages before it rather than letting items pile up.
+// Finished items are delivered to a sink in input order, and at most
+// `window' items are in flight at once.
+//
+// Each stage counts the items it processed and the time it spent on them,
+// and each queue counts how full it got and how long its producers and
+// consumers waited (see bounded_queue), so the stage that limits the
+// throughput can be found from a report.
+template< class Item >
+class pipeline {
+public:
+  typedef std::function< void(Item &) > stage_function;
+
+  pipeline(std::size_t capacity_, std::size_t window_) :
+    capacity(capacity_ ? capacity_ : 1), window(window_ ? window_ : 1),
+    read(0), delivered(0), sink_ns(0), seconds(0) {
+  }
+
+  pipeline(const pipeline &) = delete;
+  pipeline &operator=(const pipeline &) = delete;
+
+  // Add a stage run by a number of threads, which calls f on each item.
+  void add_stage(const std::string &name, unsigned int threads,
+    stage_function f) {
+    stages.push_back(std::unique_ptr< stage >(new stage(name,
+      threads ? threads : 1, std::move(f))));
+  }
+
+  // Run the pipeline until the source is exhausted.
+  //
+  // - `next' is called as bool(Item &) on the calling thread to read the
+  //   next item, returning false at the end of the input.
+  // - `sink' is called as void(Item &) once per item, in input order, on a
+  //   thread of its own.
+  //
+  // If any call throws, no further items are read and the first exception
+  // is rethrown once all threads have stopped.
+  template< class Source, class Sink >
+  void run(Source next, Sink sink) {
+    // Create every queue before starting any thread, since each stage
+    // writes to the queue of the next.
+    for (auto &st : stages) {
+      st->queue.reset(new bounded_queue< entry >(capacity));
+      st->running = st->threads;
+      st->items = st->busy_ns = 0;
+    }
+    sink_queue.reset(new bounded_queue< entry >(capacity));
+    read = delivered = 0;
+    error = nullptr;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector< std::thread > threads;
+    for (std::size_t i = 0; i < stages.size(); ++i) {
+      for (unsigned int j = 0; j < stages[i]->threads; ++j)
+        threads.push_back(std::thread([this, i]() { this->work_loop(i); }));
+    }
+    threads.push_back(std::thread([&]() { this->sink_loop(sink); }));
+
+    // Read items, waiting whenever `window' items are in flight.
+    for (;;) {
+      {
+        std::unique_lock< std::mutex > lock(mutex);
+        space_ready.wait(lock, [&]() {
+          return read - delivered < window || error; });
+        if (error)
+          break;
+      }
+
+      entry e;
+      e.index = read;
+      try {
+        if (!next(e.item))
+          break;
+      }
+      catch (...) {
+        fail();
+        break;
+      }
+
+      ++read;
+      if (!input_queue().push(std::move(e)))
+        break;
+    }
+    input_queue().close();
+
+    for (auto &thread : threads)
+      thread.join();
+
+    seconds = std::chrono::duration< double >(
+      std::chrono::steady_clock::now() - start).count();
+
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  // Write a report of the last run as tab-separated lines, one per stage
+  // and one for the sink.  The queue columns describe the queue in front of
+  // each stage: how full it was on average and at most, how often and how
+  // long the stage before it was blocked because it was full, and how often
+  // and how long the stage itself waited because it was empty.
+  void write_report(std::ostream &s) const {
+    if (!sink_queue)
+      return; // Not run yet
+
+    // Write the whole report at once, so it is not interleaved with other
+    // output.
+    std::ostringstream ss;
+    ss << "pipeline\tthreads\titems\tbusy_s\tutilization\tqueue_mean"
+      "\tqueue_max\tfull_waits\tfull_s\tempty_waits\tempty_s\n";
+    for (const auto &st : stages) {
+      write_queue_report(ss, st->name, st->threads, st->items,
+        st->busy_ns / 1e9, *st->queue);
+    }
+    write_queue_report(ss, "sink", 1, delivered, sink_ns / 1e9,
+      *sink_queue);
+    ss << "wall_s\t" << seconds << '\n';
+
+    s << ss.str();
+    s.flush();
+  }
+
+private:
+  // An item and its position in the input
+  struct entry {
+    std::size_t index;
+    Item item;
+  };
+
+  struct stage {
+    stage(const std::string &name_, unsigned int threads_,
+      stage_function f_) : name(name_), threads(threads_), f(std::move(f_)),
+      running(0), items(0), busy_ns(0) {
+    }
+
+    const std::string name;
+    const unsigned int threads;
+    const stage_function f;
+
+    // The queue in front of the stage, created by run()
+    std::unique_ptr< bounded_queue< entry > > queue;
+
+    // The number of threads that have not finished, so the last one closes
+    // the next queue
+    std::atomic< unsigned int > running;
+
+    std::atomic< std::uint64_t > items, busy_ns;
+  };
+
+  bounded_queue< entry > &input_queue() {
+    return stages.empty() ? *sink_queue : *stages.front()->queue;
+  }
+
+  bounded_queue< entry > &output_queue(std::size_t i) {
+    return i + 1 < stages.size() ? *stages[i + 1]->queue : *sink_queue;
+  }
+
+  void work_loop(std::size_t i) {
+    stage &st = *stages[i];
+    bounded_queue< entry > &out = output_queue(i);
+
+    for (entry e; st.queue->pop(e);) {
+      if (failed())
+        break;
+
+      const auto start = std::chrono::steady_clock::now();
+      try {
+        st.f(e.item);
+      }
+      catch (...) {
+        fail();
+        break;
+      }
+      st.busy_ns += std::chrono::duration_cast< std::chrono::nanoseconds >(
+        std::chrono::steady_clock::now() - start).count();
+      ++st.items;
+
+      if (!out.push(std::move(e)))
+        break;
+    }
+
+    if (!--st.running)
+      out.close();
+  }
+
+  // Deliver the items in input order, holding early items in a reorder
+  // buffer.  Items are read only while fewer than `window' are in flight,
+  // so each one has a slot of its own.
+  template< class Sink >
+  void sink_loop(Sink &sink) {
+    std::vector< entry > slots(window);
+    std::vector< bool > filled(window, false);
+    std::size_t next_index = 0;
+    sink_ns = 0;
+
+    for (entry e; sink_queue->pop(e);) {
+      if (failed())
+        break;
+
+      const std::size_t k = e.index % window;
+      slots[k] = std::move(e);
+      filled[k] = true;
+
+      for (; filled[next_index % window]; ++next_index) {
+        entry &t = slots[next_index % window];
+        const auto start = std::chrono::steady_clock::now();
+        try {
+          sink(t.item);
+        }
+        catch (...) {
+          fail();
+          return;
+        }
+        sink_ns += std::chrono::duration_cast< std::chrono::nanoseconds >(
+          std::chrono::steady_clock::now() - start).count();
+        filled[next_index % window] = false;
+
+        std::lock_guard< std::mutex > lock(mutex);
+        ++delivered;
+        space_ready.notify_one();
+      }
+    }
+  }
+
+  bool failed() {
+    std::lock_guard< std::mutex > lock(mutex);
+    return static_cast< bool >(error);
+  }
+
+  // Record the current exception and stop every thread.
+  void fail() {
+    {
+      std::lock_guard< std::mutex > lock(mutex);
+      if (!error)
+        error = std::current_exception();
+      space_ready.notify_all();
+    }
+
+    for (auto &st : stages)
+      st->queue->close();
+    sink_queue->close();
+  }
+
+  // Write a line of the report.  The utilization is the fraction of the
+  // run that the threads of a stage spent processing items.
+  void write_queue_report(std::ostream &s, const std::string &name,
+    unsigned int threads, std::uint64_t items, double busy,
+    const bounded_queue< entry > &queue) const {
+    const queue_counters c = queue.counters();
+    s << name << '\t' << threads << '\t' << items << '\t' << busy << '\t'
+      << (seconds > 0 ? busy / (threads * seconds) : 0.) << '\t'
+      << c.mean_occupancy()
+      << '\t' << c.max_occupancy << '\t' << c.full_waits << '\t'
+      << c.full_seconds << '\t' << c.empty_waits << '\t' << c.empty_seconds
+      << '\n';
+  }
+
+  const std::size_t capacity, window;
+
+  std::vector< std::unique_ptr< stage > > stages;
+  std::unique_ptr< bounded_queue< entry > > sink_queue;
+
+  std::mutex mutex;
+  std::condition_variable space_ready;
+  std::size_t read, delivered;
+  std::exception_ptr error;
+
+  std::uint64_t sink_ns;
+  double seconds;
+};
+
+#endif
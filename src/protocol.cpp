@@ -0,0 +1,109 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+namespace {
+
+bool read_all(int fd, void *data, std::size_t size) {
+  char *p = static_cast< char * >(data);
+  while (size) {
+    const ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool write_all(int fd, const void *data, std::size_t size) {
+  const char *p = static_cast< const char * >(data);
+  while (size) {
+    const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Fill in the address of a socket at a path.
+bool socket_address(const char *path, sockaddr_un &addr) {
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(addr.sun_path))
+    return false;
+  std::strcpy(addr.sun_path, path);
+  return true;
+}
+
+}
+
+bool read_message(int fd, std::uint32_t &code, std::string &payload) {
+  std::uint32_t header[2];
+  if (!read_all(fd, header, sizeof(header)) || header[1] > max_message_size)
+    return false;
+
+  code = header[0];
+  payload.resize(header[1]);
+  return read_all(fd, &payload[0], payload.size());
+}
+
+bool write_message(int fd, std::uint32_t code, const std::string &payload) {
+  if (payload.size() > max_message_size)
+    return false;
+
+  const std::uint32_t header[2] = {
+    code, static_cast< std::uint32_t >(payload.size()) };
+  return write_all(fd, header, sizeof(header)) &&
+    write_all(fd, payload.data(), payload.size());
+}
+
+int listen_socket(const char *path) {
+  sockaddr_un addr;
+  if (!socket_address(path, addr))
+    return -1;
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  unlink(path);
+  if (bind(fd, reinterpret_cast< sockaddr * >(&addr), sizeof(addr)) < 0 ||
+    listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int connect_socket(const char *path) {
+  sockaddr_un addr;
+  if (!socket_address(path, addr))
+    return -1;
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, reinterpret_cast< sockaddr * >(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
@@ -0,0 +1,43 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+#include <string>
+
+// Messages exchanged with the classification server over a Unix domain socket
+//
+// A message is a header of two 32-bit integers, a code and the payload size,
+// followed by the payload.  In a request, the code is the request type and
+// the payload is the sketch.  In a response, the code is the status and the
+// payload is the predicted category on the first line, followed by one line
+// per category with its label and score in decreasing order of score.
+// Integers are in host byte order, since both ends are on the same machine.
+
+// Request types
+const std::uint32_t request_svg = 1; // An SVG image
+const std::uint32_t request_strokes = 2; // Strokes in text or binary format
+
+// Response statuses
+const std::uint32_t response_ok = 0;
+const std::uint32_t response_error = 1;
+
+// The largest accepted payload
+const std::uint32_t max_message_size = 16 << 20;
+
+// The default path of the server socket
+const char *const default_socket_path = "sketchrec.sock";
+
+// Read a message, returning false on error or end of file.
+bool read_message(int fd, std::uint32_t &code, std::string &payload);
+
+// Write a message, returning false on error.
+bool write_message(int fd, std::uint32_t code, const std::string &payload);
+
+// Create a socket listening at a path, replacing any existing socket.
+// Returns -1 on error.
+int listen_socket(const char *path);
+
+// Connect to a socket at a path, returning -1 on error.
+int connect_socket(const char *path);
+
+#endif
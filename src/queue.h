@@ -0,0 +1,117 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Counters of the traffic through a queue
+struct queue_counters {
+  std::uint64_t pushes;
+  std::uint64_t occupancy_sum; // Items in the queue after each push, added up
+  std::size_t max_occupancy;
+  std::uint64_t full_waits, empty_waits; // Pushes and pops that had to wait
+  double full_seconds, empty_seconds; // The time they waited
+
+  // Return the mean number of items in the queue after a push.
+  double mean_occupancy() const {
+    return pushes ? static_cast< double >(occupancy_sum) / pushes : 0.;
+  }
+};
+
+// A thread-safe FIFO queue with a bounded capacity
+//
+// Producers block while the queue is full and consumers block while it is
+// empty.  Once the queue is closed, pushes fail and pops drain the remaining
+// items before failing.  The queue counts how full it gets and how long its
+// producers and consumers wait, so the clock is only read by threads that
+// are about to block.
+template< class T >
+class bounded_queue {
+public:
+  typedef typename std::deque< T >::size_type size_type;
+
+  explicit bounded_queue(size_type capacity_) :
+    capacity(capacity_ ? capacity_ : 1), closed(false), stats() {
+  }
+
+  size_type max_size() const {
+    return capacity;
+  }
+
+  // Add an item, waiting for space.  Returns false if the queue is closed.
+  bool push(T x) {
+    std::unique_lock< std::mutex > lock(mutex);
+    wait(lock, not_full, stats.full_waits, stats.full_seconds,
+      [&]() { return items.size() < capacity || closed; });
+    if (closed)
+      return false;
+
+    items.push_back(std::move(x));
+    ++stats.pushes;
+    stats.occupancy_sum += items.size();
+    if (items.size() > stats.max_occupancy)
+      stats.max_occupancy = items.size();
+    not_empty.notify_one();
+    return true;
+  }
+
+  // Remove an item, waiting for one to arrive.  Returns false if the queue is
+  // closed and empty.
+  bool pop(T &x) {
+    std::unique_lock< std::mutex > lock(mutex);
+    wait(lock, not_empty, stats.empty_waits, stats.empty_seconds,
+      [&]() { return !items.empty() || closed; });
+    if (items.empty())
+      return false;
+
+    x = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // Close the queue, waking all waiting threads.
+  void close() {
+    std::lock_guard< std::mutex > lock(mutex);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+  // Return the counters of the queue so far.
+  queue_counters counters() const {
+    std::lock_guard< std::mutex > lock(mutex);
+    return stats;
+  }
+
+private:
+  // Wait on a condition until a predicate holds, counting the wait and its
+  // duration if the predicate does not hold at once.
+  template< class Pred >
+  void wait(std::unique_lock< std::mutex > &lock, std::condition_variable &cv,
+    std::uint64_t &waits, double &seconds, Pred pred) {
+    if (pred())
+      return;
+
+    const auto start = std::chrono::steady_clock::now();
+    cv.wait(lock, pred);
+    ++waits;
+    seconds += std::chrono::duration< double >(
+      std::chrono::steady_clock::now() - start).count();
+  }
+
+  const size_type capacity;
+
+  mutable std::mutex mutex;
+  std::condition_variable not_full, not_empty;
+  std::deque< T > items;
+  bool closed;
+  queue_counters stats;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "input.h"
+#include "model.h"
+#include "pack.h"
+#include "types.h"
+
+namespace {
+
+// Rasterize sketches into an image pack at image size N.
+struct rasterization {
+  const sketch_source &sketches;
+  const char *pack_path;
+
+  template< long N >
+  void operator()(size_tag< N >) const {
+    typedef typename feature_desc_extractor< float, N >::image_type
+      image_type;
+
+    image_pack_writer pack(pack_path, N);
+
+    // Rasterize the images in parallel, writing them in input order.
+    #pragma omp parallel for schedule(dynamic) ordered
+    for (typename sketch_source::size_type i = 0; i < sketches.size(); ++i) {
+      const std::string &path = sketches.path(i);
+
+      image_type &image = sketch_workspace::local().buffers< N >().image;
+      sketches.load(i, image);
+
+      #pragma omp ordered
+      {
+        std::cout << "Rasterizing " << path << " (" << i + 1 << '/'
+          << sketches.size() << ")...\n";
+        pack.add(path, sketches.category(i), image);
+      }
+    }
+
+    std::cout << "Saving image pack...\n";
+    pack.close();
+  }
+};
+
+}
+
+int main(int argc, char *argv[]) {
+  // Process the command-line arguments.
+  const char *pack_path = "sketches.pack";
+  const char *zip_path = nullptr;
+  const char *fold_id = nullptr;
+  const char *category = nullptr;
+  long image_size = legacy_sizes.image_size;
+
+  {
+    int i;
+    for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h")) {
+        goto usage;
+      }
+      else if (!strcmp(argv[i], "-i")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> image_size) || !supported_image_size(image_size))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-z")) {
+        zip_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--fold")) {
+        fold_id = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--category")) {
+        category = argv[++i];
+      }
+      else {
+        break;
+      }
+    }
+
+    if (i < argc)
+      pack_path = argv[i++];
+
+    if (i != argc)
+      goto usage;
+
+    if ((fold_id || category) && !zip_path)
+      goto usage;
+  }
+
+  {
+    // Find the input files.
+    sketch_source sketches;
+    if (zip_path)
+      sketches.open_archive(zip_path);
+    if (fold_id || category)
+      sketches.select(fold_id, category);
+    else
+      sketches.read_paths(std::cin);
+
+    const rasterization r = { sketches, pack_path };
+    dispatch_image_size(image_size, r);
+  }
+
+  return 0;
+
+usage:
+  std::cerr << "Usage: " << argv[0]
+    << " [-i image-size] [-z zip-file [--fold fold-id] [--category category]]"
+    " [pack-file]\n";
+  return 1;
+}
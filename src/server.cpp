@@ -0,0 +1,341 @@
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "classifier.h"
+#include "classifier_extract.h"
+#include "features.h"
+#include "protocol.h"
+#include "queue.h"
+#include "stats.h"
+#include "strokes.h"
+#include "svg.h"
+
+namespace {
+
+// A classification request waiting for a worker
+struct job {
+  std::uint32_t type;
+  std::string payload;
+  std::promise< std::pair< std::uint32_t, std::string > > response;
+};
+
+typedef bounded_queue< std::shared_ptr< job > > job_queue;
+
+// A callable that rasterizes the sketch in a request into an image of any
+// size
+struct request_loader {
+  explicit request_loader(const job &j_) : j(j_) {
+  }
+
+  template< class T, long N >
+  void operator()(dlib::matrix< T, N, N > &image) const {
+    if (j.type == request_svg) {
+      load_svg(j.payload.data(), j.payload.size(), image);
+    }
+    else if (j.type == request_strokes) {
+      load_strokes(j.payload.data(), j.payload.size(), image);
+    }
+    else {
+      throw std::invalid_argument("unsupported request type");
+    }
+  }
+
+  const job &j;
+};
+
+// Classify requests until the queue is closed.  Each worker takes one
+// request at a time, so a burst of requests is spread over all workers.
+void work(job_queue &jobs, const classifier &c, std::size_t top_count) {
+  for (std::shared_ptr< job > j; jobs.pop(j);) {
+    try {
+      const prediction pred = classify_loaded(c, request_loader(*j), top_count);
+
+      // Write the predicted category and the top scores.
+      std::ostringstream ss;
+      ss << pred.label << '\n';
+      for (const auto &score : pred.scores)
+        ss << c.label(score.first) << ' ' << score.second << '\n';
+
+      j->response.set_value(std::make_pair(response_ok, ss.str()));
+    }
+    catch (const std::exception &e) {
+      j->response.set_value(std::make_pair(response_error,
+        std::string(e.what()) + '\n'));
+    }
+  }
+}
+
+// A client connection and the thread serving it
+struct connection {
+  explicit connection(int fd_) : fd(fd_), done(false) {
+  }
+
+  int fd;
+  std::thread thread;
+  std::atomic< bool > done;
+};
+
+// Serve the requests on a connection until the client disconnects or the
+// connection is shut down.  The socket is closed by the owner of the
+// connection, so its descriptor cannot be reused while it may be shut down.
+void serve(connection &conn, job_queue &jobs) {
+  const int fd = conn.fd;
+  for (;;) {
+    std::shared_ptr< job > j(new job);
+    if (!read_message(fd, j->type, j->payload))
+      break;
+
+    auto response = j->response.get_future();
+    if (!jobs.push(j))
+      break;
+
+    const auto res = response.get();
+    if (!write_message(fd, res.first, res.second))
+      break;
+  }
+
+  conn.done = true;
+}
+
+// Join the threads of the connections that have finished, or of all
+// connections, and close their sockets.
+void reap(std::list< std::unique_ptr< connection > > &connections,
+  bool all) {
+  for (auto i = connections.begin(); i != connections.end();) {
+    connection &conn = **i;
+    if (!all && !conn.done) {
+      ++i;
+      continue;
+    }
+
+    conn.thread.join();
+    close(conn.fd);
+    i = connections.erase(i);
+  }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  // Process the command-line arguments.
+  const char *vocab_path = "vocab.out";
+  const char *map_path = "map_id_label.txt";
+  const char *cats_path = "cats.out";
+  bool ova = true;
+  const char *socket_path = default_socket_path;
+  unsigned int thread_count = std::thread::hardware_concurrency();
+  std::size_t top_count = 5;
+  double stats_interval = 0;
+
+  {
+    int i;
+    for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h")) {
+        goto usage;
+      }
+      else if (!strcmp(argv[i], "-v")) {
+        vocab_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-m")) {
+        map_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-c")) {
+        ++i;
+        if (!strcmp(argv[i], "ova")) {
+          ova = true;
+        }
+        else if (!strcmp(argv[i], "ovo")) {
+          ova = false;
+        }
+        else {
+          std::cerr << argv[0] << ": Unsupported classifier: `" << argv[i]
+            << "'\n";
+          goto err;
+        }
+      }
+      else if (!strcmp(argv[i], "-s")) {
+        socket_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-t")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> thread_count) || !thread_count)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-k")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> top_count))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--tent")) {
+        if (!set_tent_engine(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--dense")) {
+        feature_settings().sparse = false;
+      }
+      else if (!strcmp(argv[i], "--intra")) {
+        feature_settings().intra_sketch = true;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--stats")) {
+        stats_enabled() = true;
+      }
+      else if (!strcmp(argv[i], "--stats-interval")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> stats_interval) || stats_interval <= 0)
+          goto usage;
+        stats_enabled() = true;
+      }
+      else {
+        break;
+      }
+    }
+
+    if (i < argc)
+      cats_path = argv[i++];
+
+    if (i != argc)
+      goto usage;
+
+    if (!vocab_path || !map_path || !cats_path || !socket_path)
+      goto usage;
+
+    if (!thread_count)
+      thread_count = 1;
+  }
+
+  {
+    // Take SIGINT and SIGTERM only in a thread of their own, so they never
+    // interrupt a worker.  Threads inherit the mask, so the signals are
+    // blocked before any thread is started.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    const stats_reporter reporter(std::cerr, stats_interval);
+
+    // Load the vocabulary, category map and classifier.
+    std::cout << "Loading classifier...\n";
+    const classifier c(vocab_path, map_path, cats_path, ova);
+
+    const int listen_fd = listen_socket(socket_path);
+    if (listen_fd < 0) {
+      std::cerr << argv[0] << ": Unable to listen on `" << socket_path
+        << "'\n";
+      goto err;
+    }
+
+    // Stop cleanly when interrupted.  The signal thread wakes the accept
+    // loop through a pipe.
+    int wake[2];
+    if (pipe(wake)) {
+      std::cerr << argv[0] << ": Unable to create a pipe\n";
+      close(listen_fd);
+      unlink(socket_path);
+      goto err;
+    }
+
+    std::thread signal_thread([&]() {
+      int sig;
+      sigwait(&signals, &sig);
+      const char x = 0;
+      while (write(wake[1], &x, 1) < 0) {
+      }
+    });
+
+    // Start the workers.  Requests wait in a bounded queue, so clients are
+    // held back when the workers fall behind.
+    job_queue jobs(thread_count * 32);
+    std::vector< std::thread > workers;
+    for (unsigned int i = 0; i < thread_count; ++i) {
+      workers.push_back(std::thread(work, std::ref(jobs), std::cref(c),
+        top_count));
+    }
+
+    std::cout << "Listening on " << socket_path << "...\n";
+    std::cout.flush();
+
+    // Accept connections, serving each on its own thread, until a signal
+    // arrives.
+    std::list< std::unique_ptr< connection > > connections;
+    for (;;) {
+      pollfd fds[] = { { listen_fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+      if (poll(fds, 2, -1) < 0)
+        continue;
+      if (fds[1].revents)
+        break;
+      if (!(fds[0].revents & POLLIN))
+        continue;
+
+      const int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0)
+        continue;
+
+      reap(connections, false);
+      std::unique_ptr< connection > conn(new connection(fd));
+      conn->thread = std::thread(serve, std::ref(*conn), std::ref(jobs));
+      connections.push_back(std::move(conn));
+    }
+
+    // Stop reading requests, let the workers answer the requests already
+    // queued, and wait for every thread, so nothing is still running when
+    // the classifier and the statics are destroyed.
+    std::cout << "Shutting down...\n";
+    close(listen_fd);
+    unlink(socket_path);
+    for (const auto &conn : connections)
+      shutdown(conn->fd, SHUT_RD);
+    jobs.close();
+    reap(connections, true);
+    for (auto &worker : workers)
+      worker.join();
+    signal_thread.join();
+    close(wake[0]);
+    close(wake[1]);
+  }
+
+  return 0;
+
+usage:
+  std::cerr << "Usage: " << argv[0]
+    << " [-v vocab-file] [-m map-file] [-c classifier] [-s socket-file]"
+    " [-t threads] [-k score-count]"
+    " [--tent engine] [--dense] [--intra]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]"
+    " [--stats] [--stats-interval seconds]"
+    " [cats-file]\n";
+err:
+  return 1;
+}
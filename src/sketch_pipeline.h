@@ -0,0 +1,213 @@
+#ifndef SKETCH_PIPELINE_H
+#define SKETCH_PIPELINE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "features.h"
+#include "input.h"
+#include "model.h"
+#include "pipeline.h"
+#include "stats.h"
+
+// Feature extraction over a sketch source on a staged pipeline
+//
+// By default the batch programs process each sketch from start to finish on
+// one OpenMP thread, so reading files, rendering SVG (which rsvg does one
+// image at a time) and extracting descriptors all compete for the same
+// threads.  On a pipeline, each of these steps has a pool of threads of its
+// own, sized separately, and bounded queues between them.
+
+// The number of threads of each stage and the capacity of each queue
+struct pipeline_options {
+  unsigned int read_threads, rasterize_threads, extract_threads,
+    quantize_threads;
+  std::size_t capacity;
+};
+
+// Return the default options: one reader, a quarter of the cores each for
+// rasterizing and quantizing, and every core for extraction, which is the
+// most expensive stage.
+inline pipeline_options default_pipeline_options() {
+  const unsigned int cores = std::max(std::thread::hardware_concurrency(),
+    1u);
+  const pipeline_options opts = { 1, std::max(cores / 4, 1u), cores,
+    std::max(cores / 4, 1u), 16 };
+  return opts;
+}
+
+// Parse the thread counts of the stages, either as `auto' for the defaults
+// or as a comma-separated list of four counts for reading, rasterizing,
+// extracting, and quantizing.
+inline bool parse_pipeline_threads(const char *s, pipeline_options &opts) {
+  const pipeline_options defaults = default_pipeline_options();
+  if (std::string(s) == "auto") {
+    opts.read_threads = defaults.read_threads;
+    opts.rasterize_threads = defaults.rasterize_threads;
+    opts.extract_threads = defaults.extract_threads;
+    opts.quantize_threads = defaults.quantize_threads;
+    return true;
+  }
+
+  unsigned int *const counts[] = { &opts.read_threads,
+    &opts.rasterize_threads, &opts.extract_threads, &opts.quantize_threads };
+  std::istringstream ss(s);
+  std::string item;
+  for (unsigned int *count : counts) {
+    if (!std::getline(ss, item, ','))
+      return false;
+    std::istringstream is(item);
+    if (!(is >> *count) || !is.eof() || !*count)
+      return false;
+  }
+  return ss.eof();
+}
+
+// A sketch on its way through a pipeline.  Jobs are reused for later
+// sketches once they reach the sink.
+struct sketch_job {
+  sketch_source::size_type index;
+  std::vector< char > data; // The stored data of the sketch
+  sketch_workspace ws; // The descriptors and the histogram
+};
+
+// A thread-safe stack of spare objects, so buffers are reused from one
+// sketch to the next rather than allocated for each.  Objects are only
+// created while none are spare, so no more are created than are in use at
+// once.
+template< class T >
+class free_list {
+public:
+  explicit free_list(std::size_t limit) {
+    spare.reserve(limit);
+  }
+
+  // Take a spare object, or a new one if there are none.
+  std::unique_ptr< T > take() {
+    {
+      std::lock_guard< std::mutex > lock(mutex);
+      if (!spare.empty()) {
+        std::unique_ptr< T > x = std::move(spare.back());
+        spare.pop_back();
+        return x;
+      }
+    }
+    return std::unique_ptr< T >(new T);
+  }
+
+  // Return an object for reuse.
+  void give(std::unique_ptr< T > x) {
+    std::lock_guard< std::mutex > lock(mutex);
+    spare.push_back(std::move(x));
+  }
+
+private:
+  std::mutex mutex;
+  std::vector< std::unique_ptr< T > > spare;
+};
+
+template< class Quantize, class Sink >
+struct sketch_pipeline_op {
+  sketch_pipeline_op(const sketch_source &sketches_, tent_engine_type tent_,
+    const pipeline_options &opts_, Quantize &quantize_, Sink &sink_) :
+    sketches(sketches_), tent(tent_), opts(opts_), quantize(quantize_),
+    sink(sink_) {
+  }
+
+  // A job and its rasterized image, a square matrix of N pixels.  The image
+  // is only held between rasterizing and extracting.
+  template< long N >
+  struct item {
+    typedef typename feature_desc_extractor< float, N >::image_type
+      image_type;
+
+    std::unique_ptr< sketch_job > job;
+    std::unique_ptr< image_type > image;
+  };
+
+  template< long N >
+  void operator()(size_tag< N >) const {
+    typedef item< N > item_type;
+    typedef typename item_type::image_type image_type;
+
+    // Bound the items in flight by what the queues and the threads can
+    // hold, so the reorder buffer never holds back the input.
+    const std::size_t window = opts.capacity * 5 + opts.read_threads +
+      opts.rasterize_threads + opts.extract_threads + opts.quantize_threads;
+    pipeline< item_type > p(opts.capacity, window);
+
+    // Jobs return to their list at the sink and images after extraction, so
+    // at most `window' of each are ever allocated.
+    free_list< sketch_job > jobs(window);
+    free_list< image_type > images(window);
+
+    p.add_stage("read", opts.read_threads, [&](item_type &it) {
+      sketches.read(it.job->index, it.job->data);
+    });
+
+    p.add_stage("rasterize", opts.rasterize_threads, [&](item_type &it) {
+      it.image = images.take();
+      const stage_timer t(stat_rasterize);
+      sketches.rasterize(it.job->index, it.job->data, *it.image);
+    });
+
+    p.add_stage("extract", opts.extract_threads, [&](item_type &it) {
+      // The intermediate results stay in the thread's own workspace.
+      sketch_job &job = *it.job;
+      feature_desc_extractor< float, N >::extract(*it.image,
+        sketch_workspace::local().buffers< N >(), job.ws.descs, job.ws.empty,
+        tent);
+      images.give(std::move(it.image));
+    });
+
+    if (opts.quantize_threads) {
+      p.add_stage("quantize", opts.quantize_threads, [&](item_type &it) {
+        quantize(*it.job);
+      });
+    }
+
+    sketch_source::size_type next = 0;
+    p.run([&](item_type &it) {
+      if (next == sketches.size())
+        return false;
+      it.job = jobs.take();
+      it.job->index = next++;
+      return true;
+    }, [&](item_type &it) {
+      sink(*it.job);
+      jobs.give(std::move(it.job));
+    });
+
+    if (stats_enabled())
+      p.write_report(std::cerr);
+  }
+
+  const sketch_source &sketches;
+  tent_engine_type tent;
+  const pipeline_options &opts;
+  Quantize &quantize;
+  Sink &sink;
+};
+
+// Extract the descriptors of every sketch of a source on a pipeline, at the
+// image size and with the tent engine of a model.  `quantize' is called as
+// void(sketch_job &) on the threads of the last stage, unless it has no
+// threads, and `sink' is called as void(sketch_job &) once per sketch, in
+// input order, by one thread.  If stats are enabled, the pipeline report is
+// written to standard error.
+template< class Quantize, class Sink >
+void run_sketch_pipeline(const sketch_source &sketches,
+  const model_sizes &sizes, const pipeline_options &opts, Quantize quantize,
+  Sink sink) {
+  dispatch_image_size(sizes.image_size, sketch_pipeline_op< Quantize, Sink >(
+    sketches, sizes.tent, opts, quantize, sink));
+}
+
+#endif
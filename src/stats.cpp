@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stats.h"
+
+namespace {
+
+const char *const stage_names[stat_stage_count] = {
+  "rasterize", "gradient", "orient", "conv", "gather", "quantize", "train",
+  "predict"
+};
+
+// The counters of one stage.  Only the owning thread writes them, so they
+// are updated with plain loads and stores, and are atomic only so a report
+// may read them while they change.
+struct stage_counters {
+  std::atomic< std::uint64_t > calls, total_ns, max_ns;
+  std::atomic< std::uint64_t > buckets[stat_bucket_count];
+};
+
+struct thread_stats {
+  stage_counters stages[stat_stage_count];
+};
+
+// The counters of every thread that has recorded a stage.  Blocks are never
+// freed, so they outlive their threads.
+std::mutex registry_mutex;
+std::vector< std::unique_ptr< thread_stats > > registry;
+
+thread_stats &local_stats() {
+  static thread_local thread_stats *stats = nullptr;
+  if (!stats) {
+    std::unique_ptr< thread_stats > p(new thread_stats());
+    stats = p.get();
+    std::lock_guard< std::mutex > lock(registry_mutex);
+    registry.push_back(std::move(p));
+  }
+  return *stats;
+}
+
+void add(std::atomic< std::uint64_t > &a, std::uint64_t x) {
+  a.store(a.load(std::memory_order_relaxed) + x, std::memory_order_relaxed);
+}
+
+unsigned int bucket(std::uint64_t ns) {
+  unsigned int k = 0;
+  for (std::uint64_t us = ns / 1000; us && k < stat_bucket_count - 1;
+    us >>= 1)
+    ++k;
+  return k;
+}
+
+// The upper bound of a bucket in microseconds
+std::uint64_t bucket_bound(unsigned int k) {
+  return std::uint64_t(1) << k;
+}
+
+// The totals of one stage over all threads
+struct stage_totals {
+  std::uint64_t calls, total_ns, max_ns;
+  std::uint64_t buckets[stat_bucket_count];
+
+  // Return the upper bound of the bucket holding a percentile, in
+  // microseconds.  The last bucket is bounded by the maximum.
+  double percentile(double p) const {
+    std::uint64_t n = 0;
+    for (unsigned int k = 0; k < stat_bucket_count - 1; ++k) {
+      n += buckets[k];
+      if (n >= p * calls)
+        return bucket_bound(k);
+    }
+    return max_ns / 1000.;
+  }
+};
+
+}
+
+void record_stage(stat_stage stage, std::uint64_t ns) {
+  stage_counters &c = local_stats().stages[stage];
+  add(c.calls, 1);
+  add(c.total_ns, ns);
+  if (ns > c.max_ns.load(std::memory_order_relaxed))
+    c.max_ns.store(ns, std::memory_order_relaxed);
+  add(c.buckets[bucket(ns)], 1);
+}
+
+void write_stats(std::ostream &s) {
+  stage_totals totals[stat_stage_count] = {};
+  {
+    std::lock_guard< std::mutex > lock(registry_mutex);
+    for (const auto &stats : registry) {
+      for (unsigned int i = 0; i < stat_stage_count; ++i) {
+        const stage_counters &c = stats->stages[i];
+        stage_totals &t = totals[i];
+        t.calls += c.calls.load(std::memory_order_relaxed);
+        t.total_ns += c.total_ns.load(std::memory_order_relaxed);
+        t.max_ns = std::max(t.max_ns,
+          c.max_ns.load(std::memory_order_relaxed));
+        for (unsigned int k = 0; k < stat_bucket_count; ++k)
+          t.buckets[k] += c.buckets[k].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Write the whole report at once, so it is not interleaved with other
+  // output.
+  std::ostringstream ss;
+  ss << "stage\tcalls\ttotal_s\tmean_us\tp50_us\tp90_us\tp99_us\tmax_us\n";
+  for (unsigned int i = 0; i < stat_stage_count; ++i) {
+    const stage_totals &t = totals[i];
+    if (!t.calls)
+      continue;
+    ss << stage_names[i] << '\t' << t.calls << '\t' << t.total_ns / 1e9
+      << '\t' << t.total_ns / 1e3 / t.calls << '\t' << t.percentile(.5)
+      << '\t' << t.percentile(.9) << '\t' << t.percentile(.99) << '\t'
+      << t.max_ns / 1e3 << '\n';
+  }
+
+  // Write the nonempty buckets of each histogram as the upper bound of the
+  // bucket in microseconds and its count.
+  for (unsigned int i = 0; i < stat_stage_count; ++i) {
+    const stage_totals &t = totals[i];
+    if (!t.calls)
+      continue;
+    ss << stage_names[i] << "_hist";
+    for (unsigned int k = 0; k < stat_bucket_count; ++k) {
+      if (!t.buckets[k])
+        continue;
+      ss << '\t';
+      if (k < stat_bucket_count - 1)
+        ss << '<' << bucket_bound(k);
+      else
+        ss << ">=" << bucket_bound(k - 1);
+      ss << ':' << t.buckets[k];
+    }
+    ss << '\n';
+  }
+
+  s << ss.str();
+  s.flush();
+}
+
+stats_reporter::stats_reporter(std::ostream &s_, double interval) : s(s_),
+  stopping(false) {
+  if (!stats_enabled() || interval <= 0)
+    return;
+
+  thread = std::thread([this, interval]() {
+    const auto period = std::chrono::duration< double >(interval);
+    std::unique_lock< std::mutex > lock(mutex);
+    while (!stopped.wait_for(lock, period, [this]() { return stopping; }))
+      write_stats(s);
+  });
+}
+
+stats_reporter::~stats_reporter() {
+  if (thread.joinable()) {
+    {
+      std::lock_guard< std::mutex > lock(mutex);
+      stopping = true;
+    }
+    stopped.notify_one();
+    thread.join();
+  }
+
+  if (stats_enabled())
+    write_stats(s);
+}
@@ -0,0 +1,102 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+// Per-stage counters and latency histograms
+//
+// Each thread counts the calls of each stage and their latencies in a block
+// of counters of its own, so timing a stage takes no locks and threads never
+// write to the same counters.  A report adds up the blocks of all threads,
+// including those of threads that have exited.  Nothing is timed unless
+// stats are enabled, so a disabled timer costs one branch.
+
+// The timed stages of recognition
+enum stat_stage {
+  stat_rasterize, // Loading a sketch into an image
+  stat_gradient,
+  stat_orient, // Binning the gradient by orientation
+  stat_conv, // Convolving the orientational responses with the tent kernel
+  stat_gather, // Gathering the descriptors
+  stat_quantize, // Computing a feature histogram
+  stat_train,
+  stat_predict,
+  stat_stage_count
+};
+
+// Latencies are counted in buckets of powers of two microseconds: bucket 0
+// counts latencies under 1 us, bucket k those in [2^(k-1), 2^k) us, and the
+// last bucket everything longer.
+const unsigned int stat_bucket_count = 32;
+
+inline bool &stats_enabled() {
+  static bool enabled = false;
+  return enabled;
+}
+
+// Add a call of a stage that took `ns' nanoseconds to the calling thread's
+// counters.
+void record_stage(stat_stage stage, std::uint64_t ns);
+
+// Write the counters and latency histograms of all threads, added up.
+void write_stats(std::ostream &s);
+
+// A timer that records the time from its construction to its destruction,
+// or to stop(), as a call of a stage
+class stage_timer {
+public:
+  explicit stage_timer(stat_stage stage_) : stage(stage_),
+    running(stats_enabled()) {
+    if (running)
+      start = clock_type::now();
+  }
+
+  ~stage_timer() {
+    stop();
+  }
+
+  stage_timer(const stage_timer &) = delete;
+  stage_timer &operator=(const stage_timer &) = delete;
+
+  void stop() {
+    if (!running)
+      return;
+    running = false;
+    record_stage(stage, std::chrono::duration_cast<
+      std::chrono::nanoseconds >(clock_type::now() - start).count());
+  }
+
+private:
+  typedef std::chrono::steady_clock clock_type;
+
+  stat_stage stage;
+  bool running;
+  clock_type::time_point start;
+};
+
+// Report the stats while in scope
+//
+// If stats are enabled, the stats are written when the reporter is destroyed
+// and, if `interval' is positive, every `interval' seconds until then.
+class stats_reporter {
+public:
+  stats_reporter(std::ostream &s_, double interval);
+  ~stats_reporter();
+
+  stats_reporter(const stats_reporter &) = delete;
+  stats_reporter &operator=(const stats_reporter &) = delete;
+
+private:
+  std::ostream &s;
+  std::mutex mutex;
+  std::condition_variable stopped;
+  bool stopping;
+  std::thread thread;
+};
+
+#endif
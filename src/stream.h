@@ -0,0 +1,180 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A parallel map over a stream of items that delivers results in input order
+//
+// Items are read from a source on the calling thread and processed by a pool
+// of worker threads as soon as they arrive.  Finished results wait in a
+// bounded reorder buffer until every earlier result has been delivered, so at
+// most `window' items are in flight at once.  This bounds both memory use and
+// the latency between reading an item and delivering its result, even for
+// sources that never end.
+template< class In, class Out >
+class ordered_stream {
+public:
+  ordered_stream(unsigned int threads_, std::size_t window_) :
+    threads(threads_ ? threads_ : 1), window(window_ ? window_ : 1) {
+  }
+
+  // Run the stream until the source is exhausted.
+  //
+  // - `next' is called as bool(In &) to read the next item, returning false
+  //   at the end of the stream.
+  // - `work' is called as void(const In &, Out &) on a worker thread.
+  // - `sink' is called as void(const In &, const Out &) once per item, in
+  //   input order, by one thread at a time.
+  //
+  // If any call throws, no further items are read and the first exception is
+  // rethrown once the workers have stopped.
+  template< class Source, class Work, class Sink >
+  void run(Source next, Work work, Sink sink) {
+    slots.assign(window, slot());
+    pending.clear();
+    read = delivered = 0;
+    done_reading = flushing = false;
+    error = nullptr;
+
+    std::vector< std::thread > workers;
+    for (unsigned int i = 0; i < threads; ++i)
+      workers.push_back(std::thread([&]() { this->work_loop(work, sink); }));
+
+    // Read items, waiting whenever the reorder buffer is full.
+    for (;;) {
+      In in;
+      {
+        std::unique_lock< std::mutex > lock(mutex);
+        space_ready.wait(lock, [&]() {
+          return read - delivered < window || error; });
+        if (error)
+          break;
+      }
+
+      try {
+        if (!next(in))
+          break;
+      }
+      catch (...) {
+        std::unique_lock< std::mutex > lock(mutex, std::defer_lock);
+        fail(lock);
+        break;
+      }
+
+      std::lock_guard< std::mutex > lock(mutex);
+      slot &s = slots[read % window];
+      s.in = std::move(in);
+      s.state = slot::waiting;
+      pending.push_back(read++);
+      work_ready.notify_one();
+    }
+
+    // Wait for the remaining results to be delivered.
+    {
+      std::unique_lock< std::mutex > lock(mutex);
+      done_reading = true;
+      work_ready.notify_all();
+      space_ready.wait(lock, [&]() { return delivered == read || error; });
+    }
+
+    for (auto &worker : workers)
+      worker.join();
+
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+private:
+  struct slot {
+    enum state_type { empty, waiting, finished };
+
+    slot() : state(empty) {
+    }
+
+    In in;
+    Out out;
+    state_type state;
+  };
+
+  template< class Work, class Sink >
+  void work_loop(Work &work, Sink &sink) {
+    std::unique_lock< std::mutex > lock(mutex);
+    for (;;) {
+      work_ready.wait(lock, [&]() {
+        return !pending.empty() || done_reading || error; });
+      if (pending.empty() || error)
+        break;
+
+      const std::size_t k = pending.front();
+      pending.pop_front();
+      slot &s = slots[k % window];
+
+      // Process the item without holding the lock.  The slot is not touched
+      // by any other thread until its result has been delivered.
+      lock.unlock();
+      try {
+        work(s.in, s.out);
+      }
+      catch (...) {
+        fail(lock);
+        break;
+      }
+      lock.lock();
+
+      s.state = slot::finished;
+      if (flushing)
+        continue;
+
+      // Deliver all consecutive finished results.
+      flushing = true;
+      while (delivered < read &&
+        slots[delivered % window].state == slot::finished) {
+        slot &t = slots[delivered % window];
+        lock.unlock();
+        try {
+          sink(t.in, t.out);
+        }
+        catch (...) {
+          fail(lock);
+          return;
+        }
+        lock.lock();
+
+        t.state = slot::empty;
+        ++delivered;
+        space_ready.notify_all();
+      }
+      flushing = false;
+    }
+  }
+
+  // Record an exception thrown while the lock was released, and stop.
+  void fail(std::unique_lock< std::mutex > &lock) {
+    lock.lock();
+    if (!error)
+      error = std::current_exception();
+    work_ready.notify_all();
+    space_ready.notify_all();
+  }
+
+  const unsigned int threads;
+  const std::size_t window;
+
+  std::mutex mutex;
+  std::condition_variable work_ready, space_ready;
+
+  std::vector< slot > slots;
+  std::deque< std::size_t > pending;
+  std::size_t read, delivered;
+  bool done_reading, flushing;
+  std::exception_ptr error;
+};
+
+#endif
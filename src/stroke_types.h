@@ -0,0 +1,14 @@
+#ifndef STROKE_TYPES_H
+#define STROKE_TYPES_H
+
+#include <vector>
+
+// A point in a stroke, in coordinates relative to the size of the image
+struct point {
+  double x, y;
+};
+
+typedef std::vector< point > path_type;
+typedef std::vector< path_type > strokes_type;
+
+#endif
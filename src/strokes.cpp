@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include <cairo.h>
+
+#include "strokes.h"
+
+namespace {
+
+const char magic[4] = { 'S', 'K', 'S', 'T' };
+
+template< class T >
+void write_value(std::ostream &s, const T &x) {
+  if (!s.write(reinterpret_cast< const char * >(&x), sizeof(T)))
+    throw stroke_error();
+}
+
+// A bounds-checked reader for binary strokes
+struct reader {
+  const char *p, *end;
+
+  template< class T >
+  T value() {
+    if (static_cast< std::size_t >(end - p) < sizeof(T))
+      throw stroke_error();
+    T x;
+    std::memcpy(&x, p, sizeof(T));
+    p += sizeof(T);
+    return x;
+  }
+};
+
+}
+
+void read_strokes(std::istream &s, strokes_type &strokes) {
+  strokes.clear();
+
+  for (std::string line; std::getline(s, line);) {
+    std::istringstream ss(line);
+    path_type path;
+    point p;
+    while (ss >> p.x) {
+      if (!(ss >> p.y))
+        throw stroke_error();
+      path.push_back(p);
+    }
+    if (!ss.eof())
+      throw stroke_error();
+
+    if (!path.empty())
+      strokes.push_back(path);
+  }
+}
+
+void write_strokes(std::ostream &s, const strokes_type &strokes) {
+  const std::streamsize precision =
+    s.precision(std::numeric_limits< double >::digits10);
+  for (const auto &path : strokes) {
+    for (path_type::size_type k = 0; k < path.size(); ++k) {
+      if (k)
+        s << ' ';
+      s << path[k].x << ' ' << path[k].y;
+    }
+    s << '\n';
+  }
+  s.precision(precision);
+
+  if (!s)
+    throw stroke_error();
+}
+
+void write_strokes_binary(std::ostream &s, const strokes_type &strokes) {
+  if (!s.write(magic, sizeof(magic)))
+    throw stroke_error();
+
+  write_value(s, static_cast< std::uint32_t >(strokes.size()));
+  for (const auto &path : strokes) {
+    write_value(s, static_cast< std::uint32_t >(path.size()));
+    for (const auto &p : path) {
+      write_value(s, static_cast< float >(p.x));
+      write_value(s, static_cast< float >(p.y));
+    }
+  }
+}
+
+bool is_binary_strokes(const char *data, std::size_t size) {
+  return size >= sizeof(magic) && !std::memcmp(data, magic, sizeof(magic));
+}
+
+void parse_strokes(const char *data, std::size_t size,
+  strokes_type &strokes) {
+  if (!is_binary_strokes(data, size)) {
+    std::istringstream ss(std::string(data, size));
+    read_strokes(ss, strokes);
+    return;
+  }
+
+  strokes.clear();
+
+  reader r = { data + sizeof(magic), data + size };
+  const std::uint32_t count = r.value< std::uint32_t >();
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const std::uint32_t n = r.value< std::uint32_t >();
+    if (static_cast< std::size_t >(r.end - r.p) / (2 * sizeof(float)) < n)
+      throw stroke_error();
+
+    path_type path(n);
+    for (auto &p : path) {
+      p.x = r.value< float >();
+      p.y = r.value< float >();
+    }
+    if (!path.empty())
+      strokes.push_back(path);
+  }
+
+  if (r.p != r.end)
+    throw stroke_error();
+}
+
+void load_strokes(const char *path, strokes_type &strokes) {
+  std::ifstream fs(path, std::ios::binary);
+  if (!fs)
+    throw stroke_error();
+
+  const std::string data((std::istreambuf_iterator< char >(fs)),
+    std::istreambuf_iterator< char >());
+  parse_strokes(data.data(), data.size(), strokes);
+}
+
+void draw_strokes(cairo_t *cr, const strokes_type &strokes) {
+  cairo_set_source_rgb(cr, 0., 0., 0.);
+  cairo_set_line_width(cr, line_width);
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+
+  for (const auto &path : strokes) {
+    if (path.empty())
+      continue;
+
+    path_type::const_iterator it = path.begin();
+    cairo_move_to(cr, it->x, it->y);
+    for (; it < path.end(); ++it)
+      cairo_line_to(cr, it->x, it->y);
+    cairo_stroke(cr);
+  }
+}
@@ -0,0 +1,169 @@
+#ifndef STROKES_H
+#define STROKES_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include <cairo.h>
+#include <dlib/matrix.h>
+
+#include "stroke_types.h"
+#include "util.h"
+
+// The width of a line as a fraction of the size of the image.
+const double line_width = 0.00375;
+
+// An error while reading strokes
+struct stroke_error : std::exception {
+  virtual ~stroke_error() noexcept {
+  }
+
+  virtual const char *what() const noexcept {
+    return "stroke error";
+  }
+};
+
+// Strokes are stored in one of two formats:
+//
+//   text: one stroke per line, each a list of whitespace-separated x and y
+//     coordinates in [0, 1].  Blank lines are ignored.
+//   binary: a magic number ("SKST"), a 32-bit stroke count, and for each
+//     stroke a 32-bit point count followed by its points as pairs of 32-bit
+//     floats.  Integers and floats are in host byte order.
+
+// Read strokes in text format.
+void read_strokes(std::istream &s, strokes_type &strokes);
+
+// Write strokes in text format.
+void write_strokes(std::ostream &s, const strokes_type &strokes);
+
+// Write strokes in binary format.
+void write_strokes_binary(std::ostream &s, const strokes_type &strokes);
+
+// Return whether a buffer holds strokes in binary format.
+bool is_binary_strokes(const char *data, std::size_t size);
+
+// Parse strokes in either format from a buffer.
+void parse_strokes(const char *data, std::size_t size, strokes_type &strokes);
+
+// Load strokes in either format from a file.
+void load_strokes(const char *path, strokes_type &strokes);
+
+// Draw strokes to a Cairo context whose user space is the unit square.
+void draw_strokes(cairo_t *cr, const strokes_type &strokes);
+
+// Rasterize strokes, storing the ink coverage in a square matrix.
+//
+// Each stroke covers the points within line_width / 2 of its segments, the
+// shape draw_strokes fills with round caps and joins, so no Cairo surface
+// or path is involved.  The coverage of a pixel is estimated from the
+// distance d between its center and the stroke as the overlap of
+// [d - w / 2, d + w / 2] with the pixel, which is exact for a long straight
+// line of width w crossing the pixel along a row or column.  Overlapping
+// strokes are composited as by Cairo's OVER operator.
+template< class T, long N >
+void rasterize_strokes(const strokes_type &strokes,
+  dlib::matrix< T, N, N > &image) {
+  // The coverage of the current stroke
+  static thread_local std::vector< T > cov(N * N);
+
+  // Pixels whose centers are closer than reach to a stroke get some ink.
+  const double r = line_width * N / 2.0;
+  const double reach = r + 0.5;
+  image = 0;
+
+  for (const auto &path : strokes) {
+    if (path.empty())
+      continue;
+
+    image_region bounds = { N, 0, N, 0 };
+    for (path_type::size_type k = 0; k < path.size(); ++k) {
+      // A single point is drawn as a dot.
+      const point &p0 = path[k ? k - 1 : 0], &p1 = path[k];
+      const double ax = p0.x * N, ay = p0.y * N;
+      const double dx = p1.x * N - ax, dy = p1.y * N - ay;
+      const double len2 = dx * dx + dy * dy;
+
+      const image_region seg = {
+        std::max(static_cast< long >(std::floor(std::min(ay, ay + dy) - reach)),
+          0L),
+        std::min(static_cast< long >(std::ceil(std::max(ay, ay + dy) + reach)),
+          N),
+        std::max(static_cast< long >(std::floor(std::min(ax, ax + dx) - reach)),
+          0L),
+        std::min(static_cast< long >(std::ceil(std::max(ax, ax + dx) + reach)),
+          N)
+      };
+      if (seg.empty())
+        continue;
+
+      bounds.top = std::min(bounds.top, seg.top);
+      bounds.bottom = std::max(bounds.bottom, seg.bottom);
+      bounds.left = std::min(bounds.left, seg.left);
+      bounds.right = std::max(bounds.right, seg.right);
+
+      for (long j = seg.top; j < seg.bottom; ++j) {
+        const double py = j + 0.5 - ay;
+        T *row = &cov[j * N];
+        for (long i = seg.left; i < seg.right; ++i) {
+          const double px = i + 0.5 - ax;
+          const double t = len2 > 0 ?
+            std::min(std::max((px * dx + py * dy) / len2, 0.0), 1.0) : 0.0;
+          const double ex = px - t * dx, ey = py - t * dy;
+          const double d = std::sqrt(ex * ex + ey * ey);
+          const T c = static_cast< T >(std::min(d + r, 0.5) -
+            std::max(d - r, -0.5));
+          row[i] = std::max(row[i], c);
+        }
+      }
+    }
+
+    // Composite the stroke and clear its coverage.
+    for (long j = bounds.top; j < bounds.bottom; ++j) {
+      T *row = &cov[j * N];
+      for (long i = bounds.left; i < bounds.right; ++i) {
+        image(j, i) += row[i] * (1 - image(j, i));
+        row[i] = 0;
+      }
+    }
+  }
+}
+
+// Load strokes in either format from a file, storing the ink coverage of
+// the rasterized strokes in a square matrix.
+template< class T, long N >
+void load_strokes(const char *path, dlib::matrix< T, N, N > &image) {
+  static thread_local strokes_type strokes;
+  load_strokes(path, strokes);
+  rasterize_strokes(strokes, image);
+}
+
+// Parse strokes in either format from memory, storing the ink coverage of
+// the rasterized strokes in a square matrix.
+template< class T, long N >
+void load_strokes(const char *data, std::size_t size,
+  dlib::matrix< T, N, N > &image) {
+  static thread_local strokes_type strokes;
+  parse_strokes(data, size, strokes);
+  rasterize_strokes(strokes, image);
+}
+
+// A callable that rasterizes strokes into an image of any size
+struct strokes_loader {
+  explicit strokes_loader(const strokes_type &strokes_) : strokes(strokes_) {
+  }
+
+  template< class T, long N >
+  void operator()(dlib::matrix< T, N, N > &image) const {
+    rasterize_strokes(strokes, image);
+  }
+
+  const strokes_type &strokes;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SVG_H
 #define SVG_H
 
+#include <cstddef>
 #include <memory>
 
 #include <cairo.h>
@@ -8,6 +9,8 @@
 #include <glib-object.h>
 #include <librsvg/rsvg.h>
 
+#include "util.h"
+
 // An error while loading an image
 struct image_error : std::exception {
   virtual ~image_error() noexcept {
@@ -41,64 +44,116 @@ template< class T > struct glib_delete {
   }
 };
 
-// Load an SVG file, storing the rasterized image in a square matrix.
-template< class T, long N >
-void load_svg(const char *file, dlib::matrix< T, N, N > &image) {
-  std::unique_ptr< cairo_surface_t, cairo_delete< cairo_surface_t > >
-    surface(cairo_image_surface_create(CAIRO_FORMAT_RGB24, N, N));
-  if (!surface)
-    throw image_error();
+// A reusable context for rasterizing images into N x N matrices
+//
+// Images are rendered into an 8-bit alpha surface, so each pixel holds the
+// ink coverage directly.  The surface and context are kept between calls, so
+// rasterizing a batch of images allocates nothing per image.  A rasterizer
+// must only be used by one thread at a time; see local().
+template< long N >
+class rasterizer {
+public:
+  rasterizer() :
+    surface(cairo_image_surface_create(CAIRO_FORMAT_A8, N, N)),
+    cr(cairo_create(surface.get())) {
+    if (cairo_surface_status(surface.get()) != CAIRO_STATUS_SUCCESS ||
+      cairo_status(cr.get()) != CAIRO_STATUS_SUCCESS)
+      throw image_error();
+  }
 
-  std::unique_ptr< cairo_t, cairo_delete< cairo_t > >
-    cr(cairo_create(surface.get()));
-  if (cairo_status(cr.get()) != CAIRO_STATUS_SUCCESS)
-    throw image_error();
+  // Return the rasterizer for the calling thread.
+  static rasterizer &local() {
+    static thread_local rasterizer r;
+    return r;
+  }
 
-  // Clear the buffer to white.
-  cairo_set_source_rgb(cr.get(), 1., 1., 1.);
-  cairo_paint(cr.get());
+  // Rasterize an image drawn by a function called as bool(cairo_t *), which
+  // returns false on failure.  The ink coverage of each pixel is stored in a
+  // square matrix (0 is blank and 1 is fully inked).  The context is in
+  // pixel coordinates and its state is restored after drawing.
+  template< class T, class Draw >
+  void render(Draw draw, dlib::matrix< T, N, N > &image) {
+    cairo_save(cr.get());
 
-  {
-    GError *error;
-    std::unique_ptr< RsvgHandle, glib_delete< RsvgHandle > >
-      svg(rsvg_handle_new_from_file(file, &error));
-    if (!svg)
-      throw image_error();
+    // Clear the surface.
+    cairo_set_operator(cr.get(), CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr.get());
+    cairo_set_operator(cr.get(), CAIRO_OPERATOR_OVER);
 
-    RsvgDimensionData dims;
-    rsvg_handle_get_dimensions(svg.get(), &dims);
+    const bool res = draw(cr.get());
 
-    // Loaded images must be square.
-    if (dims.width != dims.height)
+    cairo_restore(cr.get());
+    if (!res)
       throw image_error();
 
+    cairo_surface_flush(surface.get());
+
+    // Store the image in the matrix.
+    const unsigned char *p = cairo_image_surface_get_data(surface.get());
+    const int stride = cairo_image_surface_get_stride(surface.get());
+    for (long j = 0; j < N; ++j, p += stride)
+      unit_from_u8(p, &image(j, 0), N);
+  }
+
+private:
+  std::unique_ptr< cairo_surface_t, cairo_delete< cairo_surface_t > >
+    surface;
+  std::unique_ptr< cairo_t, cairo_delete< cairo_t > > cr;
+};
+
+// Rasterize an SVG image, storing the ink coverage in a square matrix.
+template< class T, long N >
+void render_svg(RsvgHandle *svg, dlib::matrix< T, N, N > &image) {
+  RsvgDimensionData dims;
+  rsvg_handle_get_dimensions(svg, &dims);
+
+  // Loaded images must be square.
+  if (dims.width != dims.height)
+    throw image_error();
+
+  rasterizer< N >::local().render([&](cairo_t *cr) {
     const double scale = static_cast< double >(N) / dims.width;
-    cairo_scale(cr.get(), scale, scale);
+    cairo_scale(cr, scale, scale);
 
     gboolean res;
     #pragma omp critical
     {
-      res = rsvg_handle_render_cairo(svg.get(), cr.get());
+      res = rsvg_handle_render_cairo(svg, cr);
     }
-    if (!res)
-      throw image_error();
-  }
+    return static_cast< bool >(res);
+  }, image);
+}
 
-  cairo_surface_flush(surface.get());
+// Load an SVG file, storing the ink coverage of the rasterized image in a
+// square matrix.
+template< class T, long N >
+void load_svg(const char *file, dlib::matrix< T, N, N > &image) {
+  GError *error = nullptr;
+  std::unique_ptr< RsvgHandle, glib_delete< RsvgHandle > >
+    svg(rsvg_handle_new_from_file(file, &error));
+  if (!svg) {
+    g_clear_error(&error);
+    throw image_error();
+  }
 
-  // Store the image in the matrix.
-  {
-    const unsigned char *p = cairo_image_surface_get_data(surface.get());
-    const int stride = cairo_image_surface_get_stride(surface.get());
+  render_svg(svg.get(), image);
+}
 
-    const unsigned char *q = p;
-    for (long j = 0; j < N; ++j, q = p += stride) {
-      for (long i = 0; i < N; ++i, q += 4) {
-        // Convert the image to grayscale.
-        image(j, i) = (.299 * q[0] + .587 * q[1] + .114 * q[2]) / 255.;
-      }
-    }
+// Load an SVG image from memory, storing the ink coverage of the rasterized
+// image in a square matrix.
+template< class T, long N >
+void load_svg(const char *data, std::size_t size,
+  dlib::matrix< T, N, N > &image) {
+  GError *error = nullptr;
+  std::unique_ptr< RsvgHandle, glib_delete< RsvgHandle > >
+    svg(rsvg_handle_new_from_data(reinterpret_cast< const guint8 * >(data),
+    size, &error));
+  if (!svg) {
+    g_clear_error(&error);
+    throw image_error();
   }
+
+  render_svg(svg.get(), image);
 }
 
 #endif
@@ -1,15 +1,19 @@
 #ifndef SVM_H
 #define SVM_H
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <map>
+#include <utility>
 #include <vector>
 
 #include <dlib/matrix.h>
 #include <dlib/svm.h>
 #include <dlib/unordered_pair.h>
 
+#include "stats.h"
+
 // A trainer for one-vs-all multi-class classifiers
 template< class AnyTrainer, class LabelT, bool Verbose = false >
 struct one_vs_all_trainer2 {
@@ -152,6 +156,93 @@ private:
   AnyTrainer trainer;
 };
 
+// Compute a score for each label of a one-vs-all decision function, the
+// output of the binary decision function for that label.  Scores are sorted
+// in decreasing order, so the first label is the predicted one.  If parallel
+// is set, the binary decision functions are evaluated in parallel.
+template< class T, class... DFS >
+void decision_scores(const dlib::one_vs_all_decision_function< T, DFS... > &df,
+  const typename T::sample_type &sample,
+  std::vector< std::pair< typename T::label_type,
+  typename T::scalar_type > > &scores, bool parallel = false) {
+  typedef dlib::one_vs_all_decision_function< T, DFS... > df_type;
+  typedef typename df_type::binary_function_table binary_function_table;
+  typedef std::pair< typename T::label_type, typename T::scalar_type >
+    score_type;
+
+  const binary_function_table &dfs = df.get_binary_decision_functions();
+  std::vector< typename binary_function_table::const_iterator > its;
+  for (auto it = dfs.begin(); it != dfs.end(); ++it)
+    its.push_back(it);
+
+  scores.resize(its.size());
+  #pragma omp parallel for schedule(dynamic) if(parallel)
+  for (long i = 0; i < static_cast< long >(its.size()); ++i)
+    scores[i] = score_type(its[i]->first, its[i]->second(sample));
+
+  std::stable_sort(scores.begin(), scores.end(),
+    [](const score_type &a, const score_type &b) {
+      return a.second > b.second;
+    });
+}
+
+// Compute a score for each label of a one-vs-one decision function, the
+// number of binary decision functions that voted for that label.  Scores are
+// sorted in decreasing order, so the first label is the predicted one.  If
+// parallel is set, the binary decision functions are evaluated in parallel.
+template< class T, class... DFS >
+void decision_scores(const dlib::one_vs_one_decision_function< T, DFS... > &df,
+  const typename T::sample_type &sample,
+  std::vector< std::pair< typename T::label_type,
+  typename T::scalar_type > > &scores, bool parallel = false) {
+  typedef dlib::one_vs_one_decision_function< T, DFS... > df_type;
+  typedef typename df_type::binary_function_table binary_function_table;
+  typedef std::pair< typename T::label_type, typename T::scalar_type >
+    score_type;
+
+  const binary_function_table &dfs = df.get_binary_decision_functions();
+  std::vector< typename binary_function_table::const_iterator > its;
+  for (auto it = dfs.begin(); it != dfs.end(); ++it)
+    its.push_back(it);
+
+  std::vector< char > firsts(its.size());
+  #pragma omp parallel for schedule(dynamic) if(parallel)
+  for (long i = 0; i < static_cast< long >(its.size()); ++i)
+    firsts[i] = its[i]->second(sample) > 0;
+
+  std::map< typename T::label_type, typename T::scalar_type > votes;
+  for (const auto &label : df.get_labels())
+    votes[label] = 0;
+  for (typename std::vector< char >::size_type i = 0; i < its.size(); ++i) {
+    if (firsts[i])
+      ++votes[its[i]->first.first];
+    else
+      ++votes[its[i]->first.second];
+  }
+
+  scores.assign(votes.begin(), votes.end());
+  std::stable_sort(scores.begin(), scores.end(),
+    [](const score_type &a, const score_type &b) {
+      return a.second > b.second;
+    });
+}
+
+// Predict the label of a sample with a multi-class decision function.  If
+// parallel is set, the binary decision functions are evaluated in parallel.
+// The prediction is the same either way, since ties are broken in label
+// order in both cases.
+template< class DF >
+typename DF::result_type predict(const DF &df,
+  const typename DF::sample_type &sample, bool parallel) {
+  if (!parallel)
+    return df(sample);
+
+  static thread_local std::vector< std::pair< typename DF::result_type,
+    typename DF::scalar_type > > scores;
+  decision_scores(df, sample, scores, true);
+  return scores.empty() ? df(sample) : scores[0].first;
+}
+
 // Run a multi-class decision function on a test set, returning the confusion
 // matrix.
 template< class DF, class SampleT, class LabelT, bool Verbose = false >
@@ -191,7 +282,10 @@ const dlib::matrix< double > test_multiclass_decision_function2(
       }
     }
 
-    const auto pred_offset = label_offsets.find(df(test_samples[i]))->second;
+    stage_timer t(stat_predict);
+    const LabelT pred = df(test_samples[i]);
+    t.stop();
+    const auto pred_offset = label_offsets.find(pred)->second;
 
     #pragma omp critical
     {
@@ -295,9 +389,14 @@ const dlib::matrix< double > cross_validate_multiclass_trainer2(
         << folds << "...\n";
     }
 
+    stage_timer t(stat_train);
+    const typename Trainer::trained_function_type df(
+      trainer.train(train_samples, train_labels));
+    t.stop();
+
     conf += test_multiclass_decision_function2<
       typename Trainer::trained_function_type, SampleT, LabelT, Verbose >(
-      trainer.train(train_samples, train_labels), test_samples, test_labels);
+      df, test_samples, test_labels);
   }
 
   return conf;
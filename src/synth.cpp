@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <sstream>
+
+#include "strokes.h"
+#include "synth.h"
+
+namespace {
+
+// The spacing of the points along a synthetic stroke
+const double point_spacing = 0.01;
+
+// Return a uniform random number in [lo, hi).
+double uniform(std::mt19937 &g, double lo, double hi) {
+  return lo + (hi - lo) * (g() / 4294967296.0);
+}
+
+}
+
+void sketch_synth::generate(std::uint32_t cat, std::uint32_t index,
+  strokes_type &strokes) const {
+  // Draw the control points of the category's template.
+  strokes_type controls;
+  {
+    std::seed_seq seq = { seed, cat };
+    std::mt19937 g(seq);
+
+    const unsigned int stroke_count = 2 + g() % 3;
+    for (unsigned int i = 0; i < stroke_count; ++i) {
+      const unsigned int point_count = 3 + g() % 5;
+      path_type path;
+      point p = { uniform(g, 0.2, 0.8), uniform(g, 0.2, 0.8) };
+      path.push_back(p);
+      for (unsigned int k = 1; k < point_count; ++k) {
+        p.x = std::min(std::max(p.x + uniform(g, -0.25, 0.25), 0.1), 0.9);
+        p.y = std::min(std::max(p.y + uniform(g, -0.25, 0.25), 0.1), 0.9);
+        path.push_back(p);
+      }
+      controls.push_back(path);
+    }
+  }
+
+  // Perturb the template and interpolate points along each stroke.
+  std::seed_seq seq = { seed, cat, index, 1u };
+  std::mt19937 g(seq);
+
+  const double scale = uniform(g, 0.85, 1.15);
+  const double dx = uniform(g, -0.05, 0.05), dy = uniform(g, -0.05, 0.05);
+
+  strokes.clear();
+  for (auto &path : controls) {
+    for (auto &p : path) {
+      p.x = 0.5 + (p.x - 0.5) * scale + dx + uniform(g, -0.02, 0.02);
+      p.y = 0.5 + (p.y - 0.5) * scale + dy + uniform(g, -0.02, 0.02);
+    }
+
+    path_type stroke(1, path[0]);
+    for (path_type::size_type k = 1; k < path.size(); ++k) {
+      const point &a = path[k - 1], &b = path[k];
+      const unsigned int steps = std::max(1.0,
+        std::ceil(std::hypot(b.x - a.x, b.y - a.y) / point_spacing));
+      for (unsigned int t = 1; t <= steps; ++t) {
+        const point p = { a.x + (b.x - a.x) * t / steps,
+          a.y + (b.y - a.y) * t / steps };
+        stroke.push_back(p);
+      }
+    }
+    strokes.push_back(stroke);
+  }
+}
+
+void write_svg(std::ostream &s, const strokes_type &strokes, double size) {
+  std::ostringstream ss;
+  ss << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << size
+    << "\" height=\"" << size << "\">\n";
+
+  ss.setf(std::ios::fixed);
+  ss.precision(2);
+  for (const auto &path : strokes) {
+    if (path.empty())
+      continue;
+
+    // Start with a zero-length segment, as draw_strokes does, so a single
+    // point is drawn as a dot.
+    ss << "<path d=\"M " << path[0].x * size << ' ' << path[0].y * size;
+    for (const auto &p : path)
+      ss << " L " << p.x * size << ' ' << p.y * size;
+    ss << "\" fill=\"none\" stroke=\"#000\" stroke-width=\""
+      << line_width * size << "\" stroke-linecap=\"round\""
+      " stroke-linejoin=\"round\"/>\n";
+  }
+  ss << "</svg>\n";
+
+  s << ss.str();
+}
@@ -0,0 +1,36 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <cstdint>
+#include <ostream>
+
+#include "strokes.h"
+
+// Synthetic sketches for benchmarking and testing without the dataset
+//
+// Each category has a template of a few random strokes, and each sketch of a
+// category is its template with the points jittered and the whole sketch
+// scaled and shifted.  Sketches of one category resemble each other, so a
+// classifier trained on them has something to learn.  A sketch depends only
+// on the seed, its category and its index, and is generated from the raw
+// output of std::mt19937, whose sequence is fixed by the standard, so the
+// same sketches are generated on every platform.
+class sketch_synth {
+public:
+  explicit sketch_synth(std::uint32_t seed_) : seed(seed_) {
+  }
+
+  // Generate sketch `index' of category `cat'.
+  void generate(std::uint32_t cat, std::uint32_t index,
+    strokes_type &strokes) const;
+
+private:
+  std::uint32_t seed;
+};
+
+// Write strokes as a square SVG image `size' units wide, drawn with the line
+// width and round caps of draw_strokes.
+void write_svg(std::ostream &s, const strokes_type &strokes,
+  double size = 800);
+
+#endif
@@ -0,0 +1,414 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "features.h"
+#include "io.h"
+#include "kmeans.h"
+#include "model.h"
+#include "strokes.h"
+#include "svg.h"
+#include "svm.h"
+#include "synth.h"
+#include "types.h"
+#include "util.h"
+
+namespace {
+
+// The number of folds, as in util/data-fold
+const unsigned int fold_count = 8;
+
+// The number of descriptors sampled for the vocabulary, as in vocab
+const std::size_t sample_count = 1000000;
+
+// Return the label of a synthetic category.
+std::string category_label(int cat) {
+  std::ostringstream ss;
+  ss << "synth-" << cat;
+  return ss.str();
+}
+
+// Create a directory unless it exists.
+bool make_dir(const std::string &path) {
+  return !mkdir(path.c_str(), 0777) || errno == EEXIST;
+}
+
+// The sketches to generate and how they are written
+struct synth_options {
+  unsigned int category_count;
+  unsigned int sketch_count; // Per category
+  bool svg, strokes; // The formats of the sketch files
+};
+
+// Return the number of a sketch's files.  Sketches are numbered across all
+// categories, as in the dataset, so util/data-fold spreads each category
+// over all folds.
+unsigned int sketch_number(const synth_options &opts, unsigned int cat,
+  unsigned int index) {
+  return cat * opts.sketch_count + index + 1;
+}
+
+// A callable that rasterizes a synthetic sketch into an image of any size
+// the way cats rasterizes its file: from its SVG if sketches are written as
+// SVG, otherwise from its strokes.
+struct synth_loader {
+  template< class T, long N >
+  void operator()(dlib::matrix< T, N, N > &image) const {
+    if (svg) {
+      std::ostringstream ss;
+      write_svg(ss, strokes);
+      const std::string data = ss.str();
+      load_svg(data.data(), data.size(), image);
+    }
+    else {
+      rasterize_strokes(strokes, image);
+    }
+  }
+
+  const strokes_type &strokes;
+  bool svg;
+};
+
+// Generate a sketch and extract its descriptors into a workspace.
+void extract_synth(const sketch_synth &synth, const synth_options &opts,
+  const model_sizes &sizes, unsigned int cat, unsigned int index,
+  sketch_workspace &ws) {
+  static thread_local strokes_type strokes;
+  synth.generate(cat, index, strokes);
+  const synth_loader load = { strokes, opts.svg };
+  extract_sized(sizes, load, ws);
+}
+
+// Build a vocabulary from the descriptors of every sketch, as vocab does
+// for the files of all folds.
+void build_vocab(const sketch_synth &synth, const synth_options &opts,
+  const model_sizes &sizes, std::uint32_t seed, vocab_type &vocab) {
+  std::mt19937 gen(seed);
+  stream_sample< feature_desc_type > samples(sample_count);
+
+  // Extract one category at a time in parallel, then sample in order, so
+  // the vocabulary does not depend on the number of threads.
+  std::vector< std::vector< feature_desc_type > > descs(opts.sketch_count);
+  for (unsigned int cat = 0; cat < opts.category_count; ++cat) {
+    std::cout << "Extracting features for " << category_label(cat + 1)
+      << " (" << cat + 1 << '/' << opts.category_count << ")...\n";
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long i = 0; i < static_cast< long >(opts.sketch_count); ++i) {
+      sketch_workspace &ws = sketch_workspace::local();
+      extract_synth(synth, opts, sizes, cat, i, ws);
+      descs[i] = ws.descs;
+    }
+
+    for (const auto &ds : descs) {
+      for (const auto &desc : ds)
+        samples.push_back(gen, desc);
+    }
+  }
+
+  std::cout << "Got " << samples.get().size() << " descriptors\n";
+
+  std::cout << "Clustering...\n";
+  std::cout << "Picking " << sizes.word_count << " initial centers...\n";
+  kmeanspp< float >(gen, samples.get(), sizes.word_count, vocab);
+
+  kmeans< float, feature_desc_type, true >(samples.get(), vocab);
+}
+
+// The inputs and options for training a classifier on synthetic sketches
+struct training {
+  const sketch_synth &synth;
+  const synth_options &opts;
+  const vocab_type &vocab;
+  model_sizes sizes;
+  const char *cats_path;
+  bool ova;
+  float gamma, c;
+
+  // Train and save a classifier for a vocabulary of V words on the sketches
+  // outside fold 0, as util/run-cats does by default.
+  template< long V >
+  void operator()(size_tag< V >) const {
+    typedef classifier_types< V > types;
+
+    std::vector< std::pair< unsigned int, unsigned int > > keys;
+    for (unsigned int cat = 0; cat < opts.category_count; ++cat) {
+      for (unsigned int i = 0; i < opts.sketch_count; ++i) {
+        if ((sketch_number(opts, cat, i) - 1) % fold_count)
+          keys.push_back(std::make_pair(cat, i));
+      }
+    }
+
+    std::cout << "Extracting features for " << keys.size()
+      << " training sketches...\n";
+    std::vector< typename types::hist_type > samples(keys.size());
+    std::vector< int > labels(keys.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long k = 0; k < static_cast< long >(keys.size()); ++k) {
+      sketch_workspace &ws = sketch_workspace::local();
+      extract_synth(synth, opts, sizes, keys[k].first,
+        keys[k].second, ws);
+      feature_hist(ws.descs, ws.empty, vocab, samples[k]);
+      labels[k] = keys[k].first + 1;
+    }
+
+    // Train a multi-class classifier.
+    typename types::trainer_type rbf_trainer;
+    rbf_trainer.set_kernel(typename types::kernel_type(gamma));
+    rbf_trainer.set_c(c);
+
+    typename types::df_type df;
+    if (ova) {
+      std::cout << "Training one-vs-all classifier...\n";
+      df.template get< typename types::ova_df_type >() =
+        typename types::ova_trainer_type(rbf_trainer).train(samples, labels);
+    }
+    else {
+      std::cout << "Training one-vs-one classifier...\n";
+      df.template get< typename types::ovo_df_type >() =
+        typename types::ovo_trainer_type(rbf_trainer).train(samples, labels);
+    }
+
+    std::cout << "Saving classifier...\n";
+    save_classifier< V >(cats_path, sizes, ova, df);
+  }
+};
+
+}
+
+int main(int argc, char *argv[]) {
+  // Process the command-line arguments.
+  synth_options opts = { 10, 80, true, false };
+  std::uint32_t seed = 1;
+  std::string data_dir = "data";
+  const char *map_path = nullptr;
+  const char *vocab_path = nullptr;
+  const char *cats_path = nullptr;
+  model_sizes sizes = legacy_sizes;
+  bool ova = true;
+  typename kernel_type::scalar_type gamma = 17.8;
+  typename kernel_type::scalar_type c = 3.2;
+
+  {
+    int i;
+    for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h")) {
+        goto usage;
+      }
+      else if (!strcmp(argv[i], "-k")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> opts.category_count) || opts.category_count < 2)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-n")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> opts.sketch_count) || !opts.sketch_count)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-s")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> seed))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-f")) {
+        ++i;
+        if (!strcmp(argv[i], "svg")) {
+          opts.svg = true;
+          opts.strokes = false;
+        }
+        else if (!strcmp(argv[i], "strokes")) {
+          opts.svg = false;
+          opts.strokes = true;
+        }
+        else if (!strcmp(argv[i], "both")) {
+          opts.svg = true;
+          opts.strokes = true;
+        }
+        else {
+          std::cerr << argv[0] << ": Unsupported format: `" << argv[i]
+            << "'\n";
+          goto err;
+        }
+      }
+      else if (!strcmp(argv[i], "-m")) {
+        map_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-v")) {
+        vocab_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-i")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> sizes.image_size) ||
+          !supported_image_size(sizes.image_size))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-w")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> sizes.word_count) ||
+          !supported_word_count(sizes.word_count))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--cats")) {
+        cats_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-c")) {
+        ++i;
+        if (!strcmp(argv[i], "ova")) {
+          ova = true;
+        }
+        else if (!strcmp(argv[i], "ovo")) {
+          ova = false;
+        }
+        else {
+          std::cerr << argv[0] << ": Unsupported classifier: `" << argv[i]
+            << "'\n";
+          goto err;
+        }
+      }
+      else if (!strcmp(argv[i], "-g")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> gamma))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-C")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> c))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--tent")) {
+        if (!set_tent_engine(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--dense")) {
+        feature_settings().sparse = false;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else {
+        break;
+      }
+    }
+
+    if (i < argc)
+      data_dir = argv[i++];
+
+    if (i != argc)
+      goto usage;
+  }
+
+  {
+    const sketch_synth synth(seed);
+
+    // Write the sketches and the category map.
+    const std::string svg_dir = data_dir + "/svg";
+    if (!make_dir(data_dir) || !make_dir(svg_dir)) {
+      std::cerr << argv[0] << ": Cannot create directory: `" << svg_dir
+        << "'\n";
+      goto err;
+    }
+
+    const std::string map_file = map_path ? map_path :
+      data_dir + "/map_id_label.txt";
+    std::ofstream map_fs(map_file);
+
+    strokes_type strokes;
+    for (unsigned int cat = 0; cat < opts.category_count; ++cat) {
+      const std::string label = category_label(cat + 1);
+      std::cout << "Writing " << opts.sketch_count << " sketches of "
+        << label << " (" << cat + 1 << '/' << opts.category_count
+        << ")...\n";
+
+      map_fs << cat + 1 << ',' << label << '\n';
+
+      const std::string dir = svg_dir + '/' + label;
+      if (!make_dir(dir)) {
+        std::cerr << argv[0] << ": Cannot create directory: `" << dir
+          << "'\n";
+        goto err;
+      }
+
+      for (unsigned int i = 0; i < opts.sketch_count; ++i) {
+        synth.generate(cat, i, strokes);
+
+        std::ostringstream ss;
+        ss << dir << '/' << sketch_number(opts, cat, i);
+        const std::string base = ss.str();
+
+        if (opts.svg) {
+          std::ofstream fs(base + ".svg");
+          write_svg(fs, strokes);
+          if (!fs) {
+            std::cerr << argv[0] << ": Cannot write file: `" << base
+              << ".svg'\n";
+            goto err;
+          }
+        }
+        if (opts.strokes) {
+          std::ofstream fs(base + ".strokes", std::ios::binary);
+          write_strokes_binary(fs, strokes);
+          if (!fs) {
+            std::cerr << argv[0] << ": Cannot write file: `" << base
+              << ".strokes'\n";
+            goto err;
+          }
+        }
+      }
+    }
+
+    if (!map_fs.flush()) {
+      std::cerr << argv[0] << ": Cannot write file: `" << map_file << "'\n";
+      goto err;
+    }
+
+    // Build the models from the same sketches, recording the engine they
+    // are extracted with.
+    sizes.tent = feature_settings().tent_engine;
+    if (vocab_path || cats_path) {
+      vocab_type vocab;
+      build_vocab(synth, opts, sizes, seed, vocab);
+
+      if (vocab_path) {
+        std::cout << "Saving vocabulary...\n";
+        save_vocab(vocab_path, sizes, vocab);
+      }
+
+      if (cats_path) {
+        const training t = { synth, opts, vocab, sizes, cats_path, ova,
+          gamma, c };
+        dispatch_word_count(sizes.word_count, t);
+      }
+    }
+  }
+
+  return 0;
+
+usage:
+  std::cerr << "Usage: " << argv[0] << " [-k category-count]"
+    " [-n sketch-count] [-s seed] [-f format] [-m map-file]"
+    " [-v vocab-file] [-i image-size] [-w word-count]"
+    " [--cats cats-file] [-c classifier] [-g gamma] [-C C]"
+    " [--tent engine] [--dense]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]"
+    " [data-dir]\n";
+err:
+  return 1;
+}
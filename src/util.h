@@ -1,12 +1,63 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <random>
 #include <vector>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <dlib/matrix.h>
 
+// A rectangle of rows [top, bottom) and columns [left, right) in an image
+struct image_region {
+  long top, bottom, left, right;
+
+  bool empty() const {
+    return top >= bottom || left >= right;
+  }
+};
+
+// Find the smallest region containing all nonzero values in an image.
+template< class T, long NR, long NC >
+image_region nonzero_region(const dlib::matrix< T, NR, NC > &m) {
+  image_region r = { m.nr(), 0, m.nc(), 0 };
+  for (long j = 0; j < m.nr(); ++j) {
+    const T *row = &m(j, 0);
+    long i = 0;
+    while (i < m.nc() && row[i] == 0)
+      ++i;
+    if (i == m.nc())
+      continue;
+
+    long k = m.nc();
+    while (row[k - 1] == 0)
+      --k;
+
+    r.top = std::min(r.top, j);
+    r.bottom = j + 1;
+    r.left = std::min(r.left, i);
+    r.right = std::max(r.right, k);
+  }
+  return r;
+}
+
+// Grow a region by n pixels on each side, clipped to an image.
+inline image_region dilate_region(const image_region &r, long n, long rows,
+  long cols) {
+  if (r.empty())
+    return r;
+  const image_region d = {
+    std::max(r.top - n, 0L), std::min(r.bottom + n, rows),
+    std::max(r.left - n, 0L), std::min(r.right + n, cols)
+  };
+  return d;
+}
+
 // 3x3 Sobel filter kernels
 extern const dlib::matrix< float, 3, 3 > sobel_x, sobel_y;
 
@@ -23,6 +74,142 @@ const dlib::matrix_op< dlib::op_normalize< Exp > > l1_normalize(
   return dlib::matrix_op< op >(op(m.ref(), s));
 }
 
+// Convert 8-bit intensities to values in [0, 1].
+template< class T >
+void unit_from_u8(const unsigned char *p, T *q, std::size_t n) {
+  for (std::size_t k = 0; k < n; ++k)
+    q[k] = p[k] / static_cast< T >(255);
+}
+
+inline void unit_from_u8(const unsigned char *p, float *q, std::size_t n) {
+  const float scale = 1.f / 255.f;
+  std::size_t k = 0;
+
+#ifdef __SSE2__
+  // Widen 16 intensities at a time to 32-bit integers and scale them.
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128i zero = _mm_setzero_si128();
+  for (; k + 16 <= n; k += 16) {
+    const __m128i x =
+      _mm_loadu_si128(reinterpret_cast< const __m128i * >(p + k));
+    const __m128i lo = _mm_unpacklo_epi8(x, zero);
+    const __m128i hi = _mm_unpackhi_epi8(x, zero);
+    _mm_storeu_ps(q + k, _mm_mul_ps(
+      _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale4));
+    _mm_storeu_ps(q + k + 4, _mm_mul_ps(
+      _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale4));
+    _mm_storeu_ps(q + k + 8, _mm_mul_ps(
+      _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale4));
+    _mm_storeu_ps(q + k + 12, _mm_mul_ps(
+      _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale4));
+  }
+#endif
+
+  for (; k < n; ++k)
+    q[k] = p[k] * scale;
+}
+
+// Compute the vertical parts of the Sobel filters for a row: the smoothed
+// sum s and the difference d of the rows above and below.
+template< class T >
+void sobel_vertical(const T *above, const T *row, const T *below, T *s,
+  T *d, std::size_t n) {
+  for (std::size_t k = 0; k < n; ++k) {
+    s[k] = above[k] + 2 * row[k] + below[k];
+    d[k] = above[k] - below[k];
+  }
+}
+
+inline void sobel_vertical(const float *above, const float *row,
+  const float *below, float *s, float *d, std::size_t n) {
+  std::size_t k = 0;
+
+#ifdef __SSE2__
+  for (; k + 4 <= n; k += 4) {
+    const __m128 a = _mm_loadu_ps(above + k);
+    const __m128 b = _mm_loadu_ps(row + k);
+    const __m128 c = _mm_loadu_ps(below + k);
+    _mm_storeu_ps(s + k, _mm_add_ps(_mm_add_ps(a, c), _mm_add_ps(b, b)));
+    _mm_storeu_ps(d + k, _mm_sub_ps(a, c));
+  }
+#endif
+
+  for (; k < n; ++k) {
+    s[k] = above[k] + 2 * row[k] + below[k];
+    d[k] = above[k] - below[k];
+  }
+}
+
+// Combine the vertical parts of the Sobel filters horizontally.  s and d
+// hold n + 2 values, padded with a zero at each end.
+template< class T >
+void sobel_horizontal(const T *s, const T *d, T *gx, T *gy, std::size_t n) {
+  for (std::size_t k = 0; k < n; ++k) {
+    gx[k] = s[k] - s[k + 2];
+    gy[k] = d[k] + 2 * d[k + 1] + d[k + 2];
+  }
+}
+
+inline void sobel_horizontal(const float *s, const float *d, float *gx,
+  float *gy, std::size_t n) {
+  std::size_t k = 0;
+
+#ifdef __SSE2__
+  for (; k + 4 <= n; k += 4) {
+    const __m128 d1 = _mm_loadu_ps(d + k + 1);
+    _mm_storeu_ps(gx + k,
+      _mm_sub_ps(_mm_loadu_ps(s + k), _mm_loadu_ps(s + k + 2)));
+    _mm_storeu_ps(gy + k, _mm_add_ps(
+      _mm_add_ps(_mm_loadu_ps(d + k), _mm_loadu_ps(d + k + 2)),
+      _mm_add_ps(d1, d1)));
+  }
+#endif
+
+  for (; k < n; ++k) {
+    gx[k] = s[k] - s[k + 2];
+    gy[k] = d[k] + 2 * d[k + 1] + d[k + 2];
+  }
+}
+
+// Compute the image gradient with the Sobel filters within a region.
+//
+// This gives the same result as conv_same with sobel_x and sobel_y, with
+// zeros outside the image, but uses the separability of the filters to
+// compute both components in one pass without temporaries.  Values outside
+// the region are left unchanged.
+template< class T, long NR, long NC >
+void sobel_gradient(const dlib::matrix< T, NR, NC > &image,
+  dlib::matrix< T, NR, NC > &gx, dlib::matrix< T, NR, NC > &gy,
+  const image_region &r) {
+  static_assert(NR > 0 && NC > 0, "sobel_gradient requires a fixed size");
+
+  const T zeros[NC] = {};
+  T s[NC + 2] = {}, d[NC + 2] = {};
+
+  // Filter the columns next to the region too, so the padded buffers hold
+  // every value the horizontal pass needs.
+  const long left = std::max(r.left - 1, 0L);
+  const long right = std::min(r.right + 1, NC);
+
+  for (long j = r.top; j < r.bottom; ++j) {
+    // dlib's convolution flips the kernel, so the row below is subtracted.
+    const T *above = (j > 0) ? &image(j - 1, 0) : zeros;
+    const T *below = (j + 1 < NR) ? &image(j + 1, 0) : zeros;
+    sobel_vertical(above + left, &image(j, left), below + left,
+      s + 1 + left, d + 1 + left, right - left);
+    sobel_horizontal(s + r.left, d + r.left, &gx(j, r.left), &gy(j, r.left),
+      r.right - r.left);
+  }
+}
+
+// Compute the image gradient with the Sobel filters.
+template< class T, long NR, long NC >
+void sobel_gradient(const dlib::matrix< T, NR, NC > &image,
+  dlib::matrix< T, NR, NC > &gx, dlib::matrix< T, NR, NC > &gy) {
+  const image_region r = { 0, NR, 0, NC };
+  sobel_gradient(image, gx, gy, r);
+}
+
 // Convert cartesian x- and y-magnitude images to radial magnitude and
 // orientation images.
 template< class T, long NR1, long NC1, long NR2, long NC2, long NR3, long NC3,
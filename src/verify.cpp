@@ -0,0 +1,916 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "conv.h"
+#include "features.h"
+#include "incremental.h"
+#include "io.h"
+#include "kmeans.h"
+#include "model.h"
+#include "strokes.h"
+#include "svm.h"
+#include "synth.h"
+#include "types.h"
+#include "util.h"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+typedef feature_desc_extractor< float, image_type::NR > extractor_type;
+typedef incremental_features< float, image_type::NR, feature_hist_type::NR >
+  incremental_type;
+
+const long image_size = image_type::NR;
+const unsigned int orient_bin_count = extractor_type::orient_bin_count;
+
+// Golden files start with a magic number and a version.
+const std::uint64_t golden_magic = 0x6676686374656b73; // "sketchvf"
+const std::uint32_t golden_version = 2;
+
+// The number of k-means iterations for the reference vocabulary
+const unsigned int kmeans_iterations = 20;
+
+// Orientations within this many radians of 7 pi / 8 are skipped when the
+// orientation binning is checked.  orient_responses drops orientations above
+// it, and the approximate angle of orient_responses4 may fall on either
+// side.
+const double orient_boundary_band = 1e-4;
+
+// A configuration of feature extraction and classification to check
+// against the reference
+struct engine {
+  const char *name;
+  tent_engine_type tent;
+  bool sparse, intra;
+  bool reference; // Use the scalar reference path (see reference_extract)
+  bool incremental; // Update incremental_features stroke by stroke
+};
+
+// The reference is the scalar extraction path the optimized kernels
+// replaced, with the plain histogram and decision functions.  For the box
+// engine, the tent convolution is computed directly rather than with an FFT,
+// so it has no rounding noise where the image is blank.
+const engine reference_engine = { "reference", tent_box, false, false, true,
+  false };
+
+// The reference with a single-image FFT, which the FFT engines are checked
+// against end to end.  The FFT leaves rounding noise where the image is
+// blank, so its histograms differ from those of the box engine.
+const engine fft_reference_engine = { "fft-reference", tent_fft, false,
+  false, true, false };
+
+const engine engines[] = {
+  reference_engine,
+  fft_reference_engine,
+  { "box-dense", tent_box, false, false, false, false },
+  { "box-sparse", tent_box, true, false, false, false },
+  { "fft-dense", tent_fft, false, false, false, false },
+  { "fft-sparse", tent_fft, true, false, false, false },
+  { "box-intra", tent_box, true, true, false, false },
+  { "fft-intra", tent_fft, true, true, false, false },
+  { "incremental", tent_box, true, false, false, true }
+};
+
+// The outputs of an engine for the sketches, each stage computed from the
+// engine's own output of the stage before
+struct engine_outputs {
+  std::vector< std::vector< feature_desc_type > > descs;
+  std::vector< feature_hist_type > hists;
+  std::vector< int > ova_preds, ovo_preds;
+};
+
+// The sketches and the outputs of the references for them.  The classifiers
+// are trained on the histograms of the box reference.
+struct golden {
+  std::uint32_t seed;
+  std::uint32_t sketch_count, category_count;
+  vocab_type vocab;
+  ova_df_type ova_df;
+  ovo_df_type ovo_df;
+  engine_outputs box, fft;
+};
+
+void save_outputs(const engine_outputs &out, std::ostream &s) {
+  serialize2(out.descs, s);
+  serialize2(out.hists, s);
+  serialize2(out.ova_preds, s);
+  serialize2(out.ovo_preds, s);
+}
+
+void load_outputs(std::istream &s, std::uint32_t sketch_count,
+  engine_outputs &out) {
+  deserialize2(out.descs, s);
+  deserialize2(out.hists, s);
+  deserialize2(out.ova_preds, s);
+  deserialize2(out.ovo_preds, s);
+  if (out.descs.size() != sketch_count || out.hists.size() != sketch_count ||
+    out.ova_preds.size() != sketch_count ||
+    out.ovo_preds.size() != sketch_count)
+    throw serialization_error();
+}
+
+void save_golden(const char *path, const golden &g) {
+  std::ofstream fs(path, std::ios::binary);
+  serialize2(golden_magic, fs);
+  serialize2(golden_version, fs);
+  serialize2(g.seed, fs);
+  serialize2(g.sketch_count, fs);
+  serialize2(g.category_count, fs);
+  serialize2(g.vocab, fs);
+  serialize2(g.ova_df, fs);
+  serialize2(g.ovo_df, fs);
+  save_outputs(g.box, fs);
+  save_outputs(g.fft, fs);
+}
+
+void load_golden(const char *path, golden &g) {
+  std::ifstream fs(path, std::ios::binary);
+  std::uint64_t magic;
+  std::uint32_t version;
+  deserialize2(magic, fs);
+  deserialize2(version, fs);
+  if (magic != golden_magic || version != golden_version)
+    throw serialization_error();
+  deserialize2(g.seed, fs);
+  deserialize2(g.sketch_count, fs);
+  deserialize2(g.category_count, fs);
+  deserialize2(g.vocab, fs);
+  deserialize2(g.ova_df, fs);
+  deserialize2(g.ovo_df, fs);
+  load_outputs(fs, g.sketch_count, g.box);
+  load_outputs(fs, g.sketch_count, g.fft);
+}
+
+// The synthetic sketches and their images
+struct sketch_set {
+  std::vector< int > labels;
+  std::vector< image_type > images;
+
+  // The image of each sketch without its last stroke, and the region where
+  // the last stroke changes it
+  std::vector< image_type > prev_images;
+  std::vector< image_region > last_regions;
+
+  // The images of each prefix of the strokes of each sketch
+  std::vector< std::vector< image_type > > prefixes;
+};
+
+void make_sketches(std::uint32_t seed, std::uint32_t sketch_count,
+  std::uint32_t category_count, sketch_set &set) {
+  const sketch_synth synth(seed);
+  set.labels.resize(sketch_count);
+  set.images.resize(sketch_count);
+  set.prev_images.resize(sketch_count);
+  set.last_regions.resize(sketch_count);
+  set.prefixes.resize(sketch_count);
+
+  strokes_type strokes;
+  for (std::uint32_t i = 0; i < sketch_count; ++i) {
+    set.labels[i] = i % category_count + 1;
+    synth.generate(set.labels[i] - 1, i / category_count, strokes);
+
+    std::vector< image_type > &prefixes = set.prefixes[i];
+    prefixes.resize(strokes.size());
+    for (strokes_type::size_type k = 0; k < strokes.size(); ++k) {
+      const strokes_type prefix(strokes.begin(), strokes.begin() + k + 1);
+      rasterize_strokes(prefix, prefixes[k]);
+    }
+
+    set.images[i] = prefixes.back();
+    if (prefixes.size() > 1)
+      set.prev_images[i] = prefixes[prefixes.size() - 2];
+    else
+      set.prev_images[i] = 0;
+    const image_type diff = set.images[i] - set.prev_images[i];
+    set.last_regions[i] = nonzero_region(diff);
+  }
+}
+
+// The intermediate results of the reference path, kept off the stack, since
+// the images are large
+struct reference_buffers {
+  image_type gx, gy; // The gradient
+  image_type g, o; // Its magnitude and its orientation in [0, pi)
+  std::vector< image_type > os; // The orientational responses
+  image_type tmp;
+  std::vector< image_type > conv; // The responses convolved with the tent
+};
+
+// Compute the gradient with dlib's convolution, bin it by orientation with
+// cart2polar and orient_responses, as extraction did before sobel_gradient
+// and orient_responses4.
+void reference_responses(const image_type &image, reference_buffers &b) {
+  b.gx = conv_same(image, sobel_x);
+  b.gy = conv_same(image, sobel_y);
+
+  cart2polar(b.gx, b.gy, b.g, b.o);
+
+  // Limit the orientation range to [0, pi).
+  for (long j = 0; j < image_size; ++j) {
+    for (long i = 0; i < image_size; ++i) {
+      if (b.o(j, i) < 0)
+        b.o(j, i) += M_PI;
+      else if (b.o(j, i) >= M_PI)
+        b.o(j, i) -= M_PI;
+    }
+  }
+
+  orient_responses(b.g, b.o, orient_bin_count, b.os);
+}
+
+// The single-image FFT convolution with the tent kernel, as extraction
+// planned it before orientations were transformed in batches
+const conv_fft< float, image_size, image_size > &reference_conv_fft() {
+  static const conv_fft< float, image_size, image_size > conv(
+    extractor_type::tent_kernel_init());
+  return conv;
+}
+
+// Convolve an image with the tent kernel of tent_kernel_init directly, as a
+// circular convolution, one dimension at a time.  The kernel is the product
+// of two 1D tents with taps at offsets [1, 2s - 1].  Sums are accumulated in
+// double precision.
+void conv_tent_direct(image_type &x, image_type &tmp) {
+  const long s = extractor_type::spatial_bin_size;
+  const long n = image_size;
+
+  for (long j = 0; j < n; ++j) {
+    for (long i = 0; i < n; ++i) {
+      double sum = 0;
+      for (long a = 1; a < 2 * s; ++a)
+        sum += (s - std::abs(a - s)) * static_cast< double >(
+          x(j, (i - a + n) % n));
+      tmp(j, i) = sum;
+    }
+  }
+
+  for (long j = 0; j < n; ++j) {
+    for (long i = 0; i < n; ++i) {
+      double sum = 0;
+      for (long a = 1; a < 2 * s; ++a)
+        sum += (s - std::abs(a - s)) * static_cast< double >(
+          tmp((j - a + n) % n, i));
+      x(j, i) = sum;
+    }
+  }
+}
+
+// Convolve the reference responses with the tent kernel for an engine.
+void reference_conv(tent_engine_type tent, reference_buffers &b) {
+  b.conv = b.os;
+  for (auto &c : b.conv) {
+    if (tent == tent_box) {
+      conv_tent_direct(c, b.tmp);
+    }
+    else {
+      reference_conv_fft()(c);
+      // Account for slightly negative responses introduced by the FFT.
+      c = abs(c);
+    }
+  }
+}
+
+// Extract descriptors on the grid from convolved responses by indexing each
+// spatial bin, with zeros outside the image.
+void reference_gather(const std::vector< image_type > &conv,
+  std::vector< feature_desc_type > &descs) {
+  const unsigned int count = extractor_type::spatial_bin_count;
+  const unsigned int size = extractor_type::spatial_bin_size;
+
+  descs.clear();
+  for (unsigned int gv = 0; gv < extractor_type::feature_grid_size; ++gv) {
+    const int v = extractor_type::grid_offset + gv * extractor_type::grid_step;
+    for (unsigned int gu = 0; gu < extractor_type::feature_grid_size; ++gu) {
+      const int u = extractor_type::grid_offset +
+        gu * extractor_type::grid_step;
+
+      feature_desc_type d;
+      for (unsigned int i = 0; i < orient_bin_count; ++i) {
+        for (unsigned int t = 0; t < count; ++t) {
+          const int y = v + spatial_bin_center(size, count, t);
+          for (unsigned int s = 0; s < count; ++s) {
+            const int x = u + spatial_bin_center(size, count, s);
+            d((i * count + t) * count + s) =
+              (0 <= y && y < image_size && 0 <= x && x < image_size) ?
+              conv[i](y, x) : 0;
+          }
+        }
+      }
+      descs.push_back(normalize(d));
+    }
+  }
+}
+
+// Extract descriptors with the reference path.
+void reference_extract(const image_type &image, tent_engine_type tent,
+  reference_buffers &b, std::vector< feature_desc_type > &descs) {
+  reference_responses(image, b);
+  reference_conv(tent, b);
+  reference_gather(b.conv, descs);
+}
+
+// Extract descriptors from convolved responses with interleave4 and gather4,
+// as feature_desc_extractor::extract does.
+void gather_descriptors(const std::vector< image_type > &conv,
+  std::vector< float > &il, std::vector< feature_desc_type > &descs) {
+  const long padded_size = extractor_type::padded_size;
+  const long margin = extractor_type::bin_margin;
+
+  il.assign(padded_size * padded_size * orient_bin_count, 0);
+  for (long j = 0; j < image_size; ++j) {
+    interleave4(&conv[0](j, 0), &conv[1](j, 0), &conv[2](j, 0),
+      &conv[3](j, 0),
+      &il[((j + margin) * padded_size + margin) * orient_bin_count],
+      image_size);
+  }
+
+  descs.clear();
+  for (unsigned int gv = 0; gv < extractor_type::feature_grid_size; ++gv) {
+    const long v = extractor_type::grid_offset +
+      gv * extractor_type::grid_step;
+    for (unsigned int gu = 0; gu < extractor_type::feature_grid_size; ++gu) {
+      const long u = extractor_type::grid_offset +
+        gu * extractor_type::grid_step;
+      feature_desc_type d;
+      gather4(&il[((v + margin) * padded_size + u + margin) *
+        orient_bin_count], extractor_type::bin_offsets::values,
+        extractor_type::spatial_bin_count * extractor_type::spatial_bin_count,
+        &d(0));
+      descs.push_back(normalize(d));
+    }
+  }
+}
+
+// Select an engine's feature extraction options.  The options are only
+// changed between engines, never while features are being extracted.  The
+// tent engine is passed to extraction explicitly.
+void select_engine(const engine &e) {
+  feature_settings().sparse = e.sparse;
+  feature_settings().intra_sketch = e.intra;
+}
+
+// Return whether a descriptor is zero, as for descriptors with empty support
+// in the image.
+bool is_zero(const feature_desc_type &d) {
+  return max(abs(d)) == 0;
+}
+
+// Compute the outputs of an engine from the images of the sketches.  The
+// incremental engine updates its features stroke by stroke.
+void run_engine(const engine &e, const sketch_set &set, const golden &g,
+  incremental_type &inc, engine_outputs &out) {
+  select_engine(e);
+
+  std::unique_ptr< reference_buffers > b(new reference_buffers);
+  out.descs.resize(g.sketch_count);
+  out.hists.resize(g.sketch_count);
+  out.ova_preds.resize(g.sketch_count);
+  out.ovo_preds.resize(g.sketch_count);
+  for (std::uint32_t i = 0; i < g.sketch_count; ++i) {
+    std::vector< feature_desc_type > &descs = out.descs[i];
+    feature_hist_type &hist = out.hists[i];
+
+    if (e.reference) {
+      reference_extract(set.images[i], e.tent, *b, descs);
+      feature_hist(descs, g.vocab, hist);
+      out.ova_preds[i] = g.ova_df(hist);
+      out.ovo_preds[i] = g.ovo_df(hist);
+      continue;
+    }
+
+    if (e.incremental) {
+      inc.reset();
+      const image_type *prev = nullptr;
+      for (const auto &image : set.prefixes[i]) {
+        if (prev) {
+          const image_type diff = image - *prev;
+          inc.update(image, nonzero_region(diff));
+        }
+        else {
+          inc.update(image, nonzero_region(image));
+        }
+        prev = &image;
+      }
+      descs = inc.descriptors();
+      hist = inc.hist();
+    }
+    else {
+      sketch_workspace &ws = sketch_workspace::local();
+      extract_descriptors(set.images[i], ws, e.tent);
+      descs = ws.descs;
+      feature_hist(descs, ws.empty, g.vocab, hist);
+    }
+
+    out.ova_preds[i] = predict(g.ova_df, hist, e.intra);
+    out.ovo_preds[i] = predict(g.ovo_df, hist, e.intra);
+  }
+}
+
+// Compute the reference outputs for the sketches.
+void make_golden(const sketch_set &set, golden &g) {
+  std::cerr << "Extracting reference features...\n";
+  std::unique_ptr< reference_buffers > b(new reference_buffers);
+  std::vector< std::vector< feature_desc_type > > descs(g.sketch_count);
+  for (std::uint32_t i = 0; i < g.sketch_count; ++i)
+    reference_extract(set.images[i], tent_box, *b, descs[i]);
+
+  std::cerr << "Building reference vocabulary...\n";
+  std::vector< feature_desc_type > samples;
+  for (const auto &ds : descs)
+    samples.insert(samples.end(), ds.begin(), ds.end());
+  std::mt19937 gen(g.seed);
+  kmeanspp< float >(gen, samples, feature_hist_type::NR, g.vocab);
+  kmeans< float >(samples, g.vocab, kmeans_iterations);
+
+  std::cerr << "Training reference classifiers...\n";
+  std::vector< feature_hist_type > hists(g.sketch_count);
+  for (std::uint32_t i = 0; i < g.sketch_count; ++i)
+    feature_hist(descs[i], g.vocab, hists[i]);
+
+  trainer_type rbf_trainer;
+  rbf_trainer.set_kernel(kernel_type(17.8));
+  rbf_trainer.set_c(3.2);
+  g.ova_df = ova_trainer_type(rbf_trainer).train(hists, set.labels);
+  g.ovo_df = ovo_trainer_type(rbf_trainer).train(hists, set.labels);
+
+  std::cerr << "Computing reference outputs...\n";
+  std::unique_ptr< incremental_type > inc(new incremental_type(g.vocab));
+  run_engine(reference_engine, set, g, *inc, g.box);
+  run_engine(fft_reference_engine, set, g, *inc, g.fft);
+}
+
+// The tolerance of each stage.  Descriptor errors are absolute, since
+// descriptors have unit length; gradient, orientation, convolution,
+// histogram and vocabulary errors are relative to the largest reference
+// value; prediction errors are counts of differing predictions.
+struct tolerances {
+  double desc, gradient, orient, conv, hist, vocab;
+  std::size_t mismatches;
+};
+
+// Write the result of checking a stage, returning whether it passed.
+bool report(const char *engine_name, const char *stage,
+  std::size_t compared, double error, double tolerance) {
+  const bool ok = error <= tolerance;
+  std::cout << engine_name << '\t' << stage << '\t' << compared << '\t'
+    << error << '\t' << tolerance << '\t' << (ok ? "ok" : "FAIL")
+    << std::endl;
+  return ok;
+}
+
+// The largest relative difference between histograms
+double hist_error(const feature_hist_type &a, const feature_hist_type &b) {
+  const float scale = max(abs(b));
+  return scale > 0 ? max(abs(a - b)) / scale : max(abs(a - b));
+}
+
+// The number of differing predictions
+std::size_t mismatches(const std::vector< int > &a,
+  const std::vector< int > &b) {
+  std::size_t count = 0;
+  for (std::vector< int >::size_type k = 0; k < a.size(); ++k) {
+    if (a[k] != b[k])
+      ++count;
+  }
+  return count;
+}
+
+// The largest difference between images, and the largest reference value
+struct image_error {
+  image_error() : error(0), scale(0) {
+  }
+
+  void add(const image_type &a, const image_type &ref) {
+    error = std::max< double >(error, max(abs(a - ref)));
+    scale = std::max< double >(scale, max(abs(ref)));
+  }
+
+  double relative() const {
+    return scale > 0 ? error / scale : error;
+  }
+
+  double error, scale;
+};
+
+// Check each optimized kernel of extraction against the stage of the
+// reference path it replaced, given the reference input of that stage, so
+// errors do not compound.
+bool check_kernels(const sketch_set &set, const tolerances &tol) {
+  std::unique_ptr< reference_buffers > b(new reference_buffers);
+  std::vector< image_type > gradient(2), os(orient_bin_count);
+  image_type &gx = gradient[0], &gy = gradient[1];
+  std::vector< float > il;
+  std::vector< feature_desc_type > descs, ref_descs;
+  const conv_tent_box< float, image_size, image_size > conv_box(
+    extractor_type::spatial_bin_size);
+  const double boundary = 7 * M_PI / 8;
+
+  image_error gradient_error, orient_error, fft_error, box_error;
+  std::size_t orient_count = 0;
+  double gather_error = 0;
+  for (const auto &image : set.images) {
+    reference_responses(image, *b);
+
+    // sobel_gradient against conv_same
+    sobel_gradient(image, gx, gy);
+    gradient_error.add(gx, b->gx);
+    gradient_error.add(gy, b->gy);
+
+    // orient_responses4 against cart2polar and orient_responses
+    for (long j = 0; j < image_size; ++j) {
+      orient_responses4(&b->gx(j, 0), &b->gy(j, 0), image_size, &os[0](j, 0),
+        &os[1](j, 0), &os[2](j, 0), &os[3](j, 0));
+    }
+    for (long j = 0; j < image_size; ++j) {
+      for (long i = 0; i < image_size; ++i) {
+        if (std::abs(b->o(j, i) - boundary) < orient_boundary_band)
+          continue;
+        for (unsigned int k = 0; k < orient_bin_count; ++k) {
+          orient_error.error = std::max< double >(orient_error.error,
+            std::abs(os[k](j, i) - b->os[k](j, i)));
+          orient_error.scale = std::max< double >(orient_error.scale,
+            std::abs(b->os[k](j, i)));
+        }
+        ++orient_count;
+      }
+    }
+
+    // The batched FFT against the single-image FFT
+    reference_conv(tent_fft, *b);
+    os = b->os;
+    extractor_type::conv_tent()(os.data(), os.size());
+    for (unsigned int k = 0; k < orient_bin_count; ++k) {
+      os[k] = abs(os[k]);
+      fft_error.add(os[k], b->conv[k]);
+    }
+
+    // interleave4 and gather4 against indexing each spatial bin
+    gather_descriptors(b->conv, il, descs);
+    reference_gather(b->conv, ref_descs);
+    for (std::vector< feature_desc_type >::size_type k = 0;
+      k < descs.size(); ++k) {
+      gather_error = std::max< double >(gather_error,
+        max(abs(descs[k] - ref_descs[k])));
+    }
+
+    // conv_tent_box against the direct convolution
+    reference_conv(tent_box, *b);
+    os = b->os;
+    for (auto &o : os)
+      conv_box(o);
+    for (unsigned int k = 0; k < orient_bin_count; ++k)
+      box_error.add(os[k], b->conv[k]);
+  }
+
+  const std::size_t pixels = set.images.size() * image_size * image_size;
+  bool ok = report("sobel_gradient", "gradient", 2 * pixels,
+    gradient_error.relative(), tol.gradient);
+  ok = report("orient_responses4", "orientations", orient_count,
+    orient_error.relative(), tol.orient) && ok;
+  ok = report("conv_fft-batch", "conv", orient_bin_count * pixels,
+    fft_error.relative(), tol.conv) && ok;
+  ok = report("conv_tent_box", "conv", orient_bin_count * pixels,
+    box_error.relative(), tol.conv) && ok;
+  ok = report("gather4", "descriptors",
+    set.images.size() * descs.size(), gather_error, tol.desc) && ok;
+  return ok;
+}
+
+// Check an engine against the reference.  Each stage after extraction is
+// first checked given the output of the box reference for the stage before,
+// so errors do not compound.  The descriptors, and then the histograms and
+// predictions computed from the engine's own descriptors (the e2e stages),
+// are checked against `ref', the outputs of the reference for the engine's
+// tent engine.  The incremental engine has no stages of its own after the
+// descriptors, and the references have no stages but their own, so they are
+// only checked end to end.
+bool check_engine(const engine &e, const sketch_set &set, const golden &g,
+  const engine_outputs &ref, const tolerances &tol, incremental_type &inc) {
+  engine_outputs out;
+  run_engine(e, set, g, inc, out);
+
+  const bool stages = !e.incremental && !e.reference;
+  double desc_error = 0, hist_err = 0, e2e_hist_err = 0;
+  std::size_t desc_count = 0, ova_mismatches = 0, ovo_mismatches = 0;
+  std::vector< bool > empty;
+  feature_hist_type hist;
+  for (std::uint32_t i = 0; i < g.sketch_count; ++i) {
+    const std::vector< feature_desc_type > &descs = out.descs[i];
+    const std::vector< feature_desc_type > &ref_descs = ref.descs[i];
+    const std::vector< feature_desc_type > &box_descs = g.box.descs[i];
+
+    // Descriptors with empty support in the box reference are skipped: the
+    // FFT leaves rounding noise there, which normalization scales to unit
+    // length.
+    if (descs.size() != ref_descs.size() ||
+      descs.size() != box_descs.size()) {
+      desc_error = std::numeric_limits< double >::infinity();
+    }
+    else {
+      for (std::vector< feature_desc_type >::size_type k = 0;
+        k < descs.size(); ++k) {
+        if (is_zero(box_descs[k]))
+          continue;
+        desc_error = std::max< double >(desc_error,
+          max(abs(descs[k] - ref_descs[k])));
+        ++desc_count;
+      }
+    }
+
+    e2e_hist_err = std::max(e2e_hist_err,
+      hist_error(out.hists[i], ref.hists[i]));
+
+    if (!stages)
+      continue;
+
+    empty.resize(box_descs.size());
+    for (std::vector< feature_desc_type >::size_type k = 0;
+      k < box_descs.size(); ++k)
+      empty[k] = is_zero(box_descs[k]);
+    feature_hist(box_descs, empty, g.vocab, hist);
+    hist_err = std::max(hist_err, hist_error(hist, g.box.hists[i]));
+
+    if (predict(g.ova_df, g.box.hists[i], e.intra) != g.box.ova_preds[i])
+      ++ova_mismatches;
+    if (predict(g.ovo_df, g.box.hists[i], e.intra) != g.box.ovo_preds[i])
+      ++ovo_mismatches;
+  }
+
+  bool ok = report(e.name, "descriptors", desc_count, desc_error, tol.desc);
+  if (stages) {
+    ok = report(e.name, "histograms", g.sketch_count, hist_err, tol.hist) &&
+      ok;
+    ok = report(e.name, "ova_predictions", g.sketch_count, ova_mismatches,
+      tol.mismatches) && ok;
+    ok = report(e.name, "ovo_predictions", g.sketch_count, ovo_mismatches,
+      tol.mismatches) && ok;
+  }
+  ok = report(e.name, "e2e_histograms", g.sketch_count, e2e_hist_err,
+    tol.hist) && ok;
+  ok = report(e.name, "e2e_ova_predictions", g.sketch_count,
+    mismatches(out.ova_preds, ref.ova_preds), tol.mismatches) && ok;
+  ok = report(e.name, "e2e_ovo_predictions", g.sketch_count,
+    mismatches(out.ovo_preds, ref.ovo_preds), tol.mismatches) && ok;
+  return ok;
+}
+
+// Time the whole pipeline of an engine from image to prediction, returning
+// the mean time per sketch in microseconds.  The incremental engine is timed
+// on the update for the last stroke of each sketch, as in gui.
+double time_engine(const engine &e, const sketch_set &set, const golden &g,
+  unsigned int repeats, incremental_type &inc) {
+  select_engine(e);
+
+  std::unique_ptr< reference_buffers > b(new reference_buffers);
+  sketch_workspace &ws = sketch_workspace::local();
+  feature_hist_type &hist = ws.hist< feature_hist_type::NR >();
+  clock_type::duration elapsed(0);
+  for (unsigned int r = 0; r < repeats; ++r) {
+    for (std::uint32_t i = 0; i < g.sketch_count; ++i) {
+      if (e.incremental) {
+        inc.reset();
+        inc.update(set.prev_images[i], nonzero_region(set.prev_images[i]));
+
+        const auto start = clock_type::now();
+        inc.update(set.images[i], set.last_regions[i]);
+        predict(g.ova_df, inc.hist(), e.intra);
+        elapsed += clock_type::now() - start;
+        continue;
+      }
+
+      const auto start = clock_type::now();
+      if (e.reference) {
+        reference_extract(set.images[i], e.tent, *b, ws.descs);
+        feature_hist(ws.descs, g.vocab, hist);
+        g.ova_df(hist);
+      }
+      else {
+        extract_descriptors(set.images[i], ws, e.tent);
+        feature_hist(ws.descs, ws.empty, g.vocab, hist);
+        predict(g.ova_df, hist, e.intra);
+      }
+      elapsed += clock_type::now() - start;
+    }
+  }
+
+  return std::chrono::duration< double, std::micro >(elapsed).count() /
+    (repeats * g.sketch_count);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  // Process the command-line arguments.
+  golden g;
+  g.seed = 1;
+  g.sketch_count = 32;
+  g.category_count = 8;
+  unsigned int repeats = 4;
+  tolerances tol = { 1e-3, 1e-5, 1e-5, 1e-4, 1e-4, 1e-4, 0 };
+  const char *record_path = nullptr;
+  const char *golden_path = nullptr;
+
+  {
+    int i;
+    for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h")) {
+        goto usage;
+      }
+      else if (!strcmp(argv[i], "-n")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> g.sketch_count) || !g.sketch_count)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-k")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> g.category_count) || g.category_count < 2)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-s")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> g.seed))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-r")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> repeats) || !repeats)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--record")) {
+        record_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--desc-tol")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> tol.desc))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--gradient-tol")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> tol.gradient))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--orient-tol")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> tol.orient))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--conv-tol")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> tol.conv))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--hist-tol")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> tol.hist))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--vocab-tol")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> tol.vocab))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--mismatches")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> tol.mismatches))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else {
+        break;
+      }
+    }
+
+    if (i < argc)
+      golden_path = argv[i++];
+
+    if (i != argc)
+      goto usage;
+
+    if (record_path && golden_path)
+      goto usage;
+
+    if (g.sketch_count < g.category_count)
+      goto usage;
+  }
+
+  {
+    // Load the reference outputs, which also fix the sketches, or compute
+    // them.
+    if (golden_path) {
+      std::cerr << "Loading golden outputs...\n";
+      load_golden(golden_path, g);
+    }
+
+    std::cerr << "Generating " << g.sketch_count << " sketches in "
+      << g.category_count << " categories...\n";
+    sketch_set set;
+    make_sketches(g.seed, g.sketch_count, g.category_count, set);
+
+    if (!golden_path)
+      make_golden(set, g);
+
+    if (record_path) {
+      std::cerr << "Saving golden outputs...\n";
+      save_golden(record_path, g);
+      return 0;
+    }
+
+    bool ok = true;
+    std::cout << "engine\tstage\tcompared\terror\ttolerance\tresult"
+      << std::endl;
+
+    // Rebuild the vocabulary from the reference descriptors.  Without a
+    // golden file, the vocabulary was just built the same way, so there is
+    // nothing to compare it with.
+    if (golden_path) {
+      std::vector< feature_desc_type > samples;
+      for (const auto &ds : g.box.descs)
+        samples.insert(samples.end(), ds.begin(), ds.end());
+      std::mt19937 gen(g.seed);
+      vocab_type vocab;
+      kmeanspp< float >(gen, samples, feature_hist_type::NR, vocab);
+      kmeans< float >(samples, vocab, kmeans_iterations);
+
+      double error = 0, scale = 0;
+      if (vocab.size() != g.vocab.size()) {
+        error = std::numeric_limits< double >::infinity();
+      }
+      else {
+        for (vocab_type::size_type k = 0; k < vocab.size(); ++k) {
+          error = std::max< double >(error, max(abs(vocab[k] - g.vocab[k])));
+          scale = std::max< double >(scale, max(abs(g.vocab[k])));
+        }
+      }
+      if (scale > 0)
+        error /= scale;
+      ok = report(reference_engine.name, "kmeans", g.vocab.size(), error,
+        tol.vocab) && ok;
+    }
+    else {
+      std::cerr << "No golden file, so k-means is not checked.\n";
+    }
+
+    ok = check_kernels(set, tol) && ok;
+
+    // Check and time each engine.  The box engines are checked end to end
+    // against the outputs of the box reference, and the FFT engines against
+    // those of the FFT reference.
+    std::unique_ptr< incremental_type > inc(new incremental_type(g.vocab));
+    for (const auto &e : engines) {
+      ok = check_engine(e, set, g, e.tent == tent_box ? g.box : g.fft, tol,
+        *inc) && ok;
+    }
+
+    std::cerr << "Timing engines...\n";
+    std::vector< double > times;
+    for (const auto &e : engines) {
+      // Warm up, which also plans the FFT, before timing.
+      time_engine(e, set, g, 1, *inc);
+      times.push_back(time_engine(e, set, g, repeats, *inc));
+    }
+
+    std::cout << "engine\tus_per_sketch\tspeedup" << std::endl;
+    for (std::vector< double >::size_type k = 0; k < times.size(); ++k) {
+      std::cout << engines[k].name << '\t' << times[k] << '\t'
+        << times[0] / times[k] << std::endl;
+    }
+
+    if (!ok)
+      goto err;
+  }
+
+  return 0;
+
+usage:
+  std::cerr << "Usage: " << argv[0] << " [-n sketch-count]"
+    " [-k category-count] [-s seed] [-r repeats] [--record golden-file]"
+    " [--desc-tol tolerance] [--gradient-tol tolerance]"
+    " [--orient-tol tolerance] [--conv-tol tolerance]"
+    " [--hist-tol tolerance] [--vocab-tol tolerance] [--mismatches count]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]"
+    " [golden-file]\n";
+err:
+  return 1;
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <random>
@@ -8,8 +10,12 @@
 #include <dlib/matrix.h>
 
 #include "features.h"
+#include "input.h"
 #include "io.h"
 #include "kmeans.h"
+#include "model.h"
+#include "sketch_pipeline.h"
+#include "stats.h"
 #include "svg.h"
 #include "types.h"
 #include "util.h"
@@ -19,7 +25,17 @@ int main(int argc, char *argv[]) {
 
   // Process the command-line arguments.
   typename stream_sample_type::size_type n = 1000000;
+  model_sizes sizes = legacy_sizes;
   const char *vocab_path = "vocab.out";
+  const char *zip_path = nullptr;
+  const char *pack_path = nullptr;
+  const char *fold_id = nullptr;
+  const char *category = nullptr;
+  std::uint32_t seed = 1;
+  bool quiet = false;
+  double stats_interval = 0;
+  bool use_pipeline = false;
+  pipeline_options pipe = default_pipeline_options();
 
   {
     int i;
@@ -27,11 +43,79 @@ int main(int argc, char *argv[]) {
       if (!strcmp(argv[i], "-h")) {
         goto usage;
       }
+      else if (!strcmp(argv[i], "-q")) {
+        quiet = true;
+      }
       else if (!strcmp(argv[i], "-n")) {
         std::istringstream ss(argv[++i]);
         if (!(ss >> n))
         goto usage;
         }
+      else if (!strcmp(argv[i], "-s")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> seed))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-i")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> sizes.image_size) ||
+          !supported_image_size(sizes.image_size))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-w")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> sizes.word_count) ||
+          !supported_word_count(sizes.word_count))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "-z")) {
+        zip_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-p")) {
+        pack_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--fold")) {
+        fold_id = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--category")) {
+        category = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--tent")) {
+        if (!set_tent_engine(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--dense")) {
+        feature_settings().sparse = false;
+      }
+      else if (!strcmp(argv[i], "--wisdom")) {
+        fft_settings().wisdom_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--no-wisdom")) {
+        fft_settings().wisdom_path = nullptr;
+      }
+      else if (!strcmp(argv[i], "--fft-effort")) {
+        if (!set_fft_effort(argv[++i]))
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--pipeline")) {
+        if (!parse_pipeline_threads(argv[++i], pipe))
+          goto usage;
+        use_pipeline = true;
+      }
+      else if (!strcmp(argv[i], "--queue")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> pipe.capacity) || !pipe.capacity)
+          goto usage;
+      }
+      else if (!strcmp(argv[i], "--stats")) {
+        stats_enabled() = true;
+      }
+      else if (!strcmp(argv[i], "--stats-interval")) {
+        std::istringstream ss(argv[++i]);
+        if (!(ss >> stats_interval) || stats_interval <= 0)
+          goto usage;
+        stats_enabled() = true;
+      }
       else {
         break;
       }
@@ -42,42 +126,83 @@ int main(int argc, char *argv[]) {
 
     if (i != argc)
       goto usage;
+
+    if ((fold_id || category) && !zip_path && !pack_path)
+      goto usage;
+
+    if (zip_path && pack_path)
+      goto usage;
   }
 
   {
-    // Extract features for all input files.
-    std::vector< std::string > paths;
-    std::string path;
-    while (std::getline(std::cin, path))
-      paths.push_back(path);
-
-    // Select a fixed number of random descriptors.
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    const stats_reporter reporter(std::cerr, stats_interval);
+
+    // Extract features for all input files with the selected engine, which
+    // is recorded in the vocabulary.
+    sizes.tent = feature_settings().tent_engine;
+    sketch_source sketches;
+    if (zip_path)
+      sketches.open_archive(zip_path);
+    if (pack_path)
+      sketches.open_pack(pack_path, sizes.image_size);
+    if (fold_id || category || pack_path)
+      sketches.select(fold_id, category);
+    else
+      sketches.read_paths(std::cin);
+
+    // Select a fixed number of random descriptors.  The descriptors are
+    // sampled in input order, so the same seed selects the same descriptors
+    // regardless of the number of threads.
+    std::mt19937 gen(seed);
     stream_sample_type samples(n);
 
-    #pragma omp parallel for schedule(dynamic)
-    for (typename std::vector< std::string >::size_type i = 0;
-      i < paths.size(); ++i) {
-      const std::string &path = paths[i];
-
-      #pragma omp critical
-      {
-        std::cout << "Extracting features for " << path << " (" << i + 1
-          << '/' << paths.size() << ")...\n";
-      }
-
-      image_type image;
-      load_svg(path.c_str(), image);
-      image = 1. - image;
-
-      std::vector< feature_desc_type > descs;
-      extract_descriptors(image, descs);
+    if (use_pipeline) {
+      // Descriptors are sampled as they arrive, so no stage quantizes.
+      pipe.quantize_threads = 0;
+      run_sketch_pipeline(sketches, sizes, pipe,
+        [](sketch_job &) {},
+        [&](sketch_job &job) {
+          if (!quiet) {
+            std::cout << "Extracted features for " << sketches.path(job.index)
+              << " (" << job.index + 1 << '/' << sketches.size() << ")\n";
+          }
+
+          for (const auto &desc : job.ws.descs)
+            samples.push_back(gen, desc);
+        });
+    }
+    else {
+      // Extract features a batch of sketches at a time in parallel, then
+      // sample the batch.
+      typedef typename sketch_source::size_type size_type;
+      const size_type batch_size = 256;
+      std::vector< std::vector< feature_desc_type > > descs(batch_size);
+
+      for (size_type begin = 0; begin < sketches.size();
+        begin += batch_size) {
+        const size_type end = std::min(begin + batch_size, sketches.size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (size_type i = begin; i < end; ++i) {
+          const std::string &path = sketches.path(i);
+
+          if (!quiet) {
+            #pragma omp critical
+            {
+              std::cout << "Extracting features for " << path << " ("
+                << i + 1 << '/' << sketches.size() << ")...\n";
+            }
+          }
+
+          sketch_workspace &ws = sketch_workspace::local();
+          extract_sized(sizes, make_loader(sketches, i), ws);
+          descs[i - begin] = ws.descs;
+        }
 
-      #pragma omp critical
-      {
-        for (const auto &desc : descs)
-          samples.push_back(gen, desc);
+        for (size_type i = begin; i < end; ++i) {
+          for (const auto &desc : descs[i - begin])
+            samples.push_back(gen, desc);
+        }
       }
     }
 
@@ -86,7 +211,7 @@ int main(int argc, char *argv[]) {
     // Generate a vocabulary for this data set.
     std::cout << "Clustering...\n";
 
-    static const long center_count = feature_hist_type::NR;
+    const long center_count = sizes.word_count;
     std::cout << "Picking " << center_count << " initial centers...\n";
     vocab_type vocab;
     kmeanspp< float >(gen, samples.get(), center_count, vocab);
@@ -95,16 +220,20 @@ int main(int argc, char *argv[]) {
 
     // Save the vocabulary.
     std::cout << "Saving vocabulary...\n";
-    {
-      std::ofstream fs(vocab_path, std::ios::binary);
-      serialize2(vocab, fs);
-    }
+    save_vocab(vocab_path, sizes, vocab);
   }
 
   return 0;
 
 usage:
-  std::cerr << "Usage: " << argv[0] << " [-n sample-count] [vocab-file]\n";
+  std::cerr << "Usage: " << argv[0] << " [-q] [-n sample-count] [-s seed]"
+    " [-i image-size] [-w word-count]"
+    " [-z zip-file | -p pack-file] [--fold fold-id] [--category category]"
+    " [--tent engine] [--dense]"
+    " [--wisdom wisdom-file | --no-wisdom] [--fft-effort effort]"
+    " [--pipeline threads [--queue capacity]]"
+    " [--stats] [--stats-interval seconds]"
+    " [vocab-file]\n";
   return 1;
 }
 
@@ -0,0 +1,168 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "zip.h"
+
+namespace {
+
+// Record signatures
+const std::uint32_t local_header_sig = 0x04034b50;
+const std::uint32_t central_header_sig = 0x02014b50;
+const std::uint32_t end_of_central_dir_sig = 0x06054b50;
+
+// Fixed record sizes
+const std::size_t local_header_size = 30;
+const std::size_t central_header_size = 46;
+const std::size_t end_of_central_dir_size = 22;
+
+// Compression methods
+const std::uint16_t method_stored = 0;
+const std::uint16_t method_deflated = 8;
+
+// Read little-endian integers from an unaligned buffer.
+inline std::uint16_t read16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+inline std::uint32_t read32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) |
+    (static_cast< std::uint32_t >(p[3]) << 24);
+}
+
+}
+
+zip_archive::zip_archive(const char *path) {
+  if (!file.open(path))
+    throw zip_error();
+
+  index();
+}
+
+const zip_entry *zip_archive::find(const std::string &name) const {
+  const auto it = names.find(name);
+  return (it != names.end()) ? &entries_[it->second] : nullptr;
+}
+
+void zip_archive::extract(const zip_entry &entry,
+  std::vector< char > &data) const {
+  const unsigned char *base = file.data();
+  const std::size_t length = file.size();
+
+  // Locate the entry data following the local file header.
+  if (entry.header_offset + local_header_size > length)
+    throw zip_error();
+  const unsigned char *header = base + entry.header_offset;
+  if (read32(header) != local_header_sig)
+    throw zip_error();
+
+  const std::size_t data_offset = entry.header_offset + local_header_size +
+    read16(header + 26) + read16(header + 28);
+  if (data_offset + entry.compressed_size > length)
+    throw zip_error();
+  const unsigned char *p = base + data_offset;
+
+  data.resize(entry.size);
+
+  if (entry.method == method_stored) {
+    if (entry.compressed_size != entry.size)
+      throw zip_error();
+    std::memcpy(data.data(), p, entry.size);
+  }
+  else if (entry.method == method_deflated) {
+    // Inflate the raw deflate stream directly into the output buffer.
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+      throw zip_error();
+
+    zs.next_in = const_cast< unsigned char * >(p);
+    zs.avail_in = entry.compressed_size;
+    zs.next_out = reinterpret_cast< unsigned char * >(data.data());
+    zs.avail_out = entry.size;
+
+    const int res = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (res != Z_STREAM_END || zs.total_out != entry.size)
+      throw zip_error();
+  }
+  else {
+    throw zip_error();
+  }
+
+  const uLong crc = crc32(crc32(0, Z_NULL, 0),
+    reinterpret_cast< const unsigned char * >(data.data()), entry.size);
+  if (crc != entry.crc)
+    throw zip_error();
+}
+
+// Read the central directory, recording the location of each file.
+void zip_archive::index() {
+  const unsigned char *base = file.data();
+  const std::size_t length = file.size();
+
+  if (length < end_of_central_dir_size)
+    throw zip_error();
+
+  // Search backwards for the end of central directory record, which may be
+  // followed by a comment of up to 64 KB.
+  const unsigned char *eocd = nullptr;
+  {
+    const std::size_t max_comment = 0xffff;
+    const std::size_t last = length - end_of_central_dir_size;
+    const std::size_t first = (last > max_comment) ? last - max_comment : 0;
+    for (std::size_t i = last + 1; i-- > first;) {
+      if (read32(base + i) == end_of_central_dir_sig) {
+        eocd = base + i;
+        break;
+      }
+    }
+  }
+  if (!eocd)
+    throw zip_error();
+
+  const std::size_t count = read16(eocd + 10);
+  const std::size_t dir_size = read32(eocd + 12);
+  const std::size_t dir_offset = read32(eocd + 16);
+
+  // Multi-disk and zip64 archives are not supported.
+  if (read16(eocd + 4) != 0 || count == 0xffff || dir_offset == 0xffffffff ||
+    dir_offset + dir_size > length)
+    throw zip_error();
+
+  entries_.reserve(count);
+
+  const unsigned char *p = base + dir_offset;
+  const unsigned char *end = p + dir_size;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (p + central_header_size > end || read32(p) != central_header_sig)
+      throw zip_error();
+
+    const std::size_t name_size = read16(p + 28);
+    const std::size_t extra_size = read16(p + 30);
+    const std::size_t comment_size = read16(p + 32);
+    if (p + central_header_size + name_size > end)
+      throw zip_error();
+
+    zip_entry entry;
+    entry.name.assign(reinterpret_cast< const char * >(p) +
+      central_header_size, name_size);
+    entry.method = read16(p + 10);
+    entry.crc = read32(p + 16);
+    entry.compressed_size = read32(p + 20);
+    entry.size = read32(p + 24);
+    entry.header_offset = read32(p + 42);
+
+    // Skip directories.
+    if (!entry.name.empty() && entry.name.back() != '/') {
+      names[entry.name] = entries_.size();
+      entries_.push_back(entry);
+    }
+
+    p += central_header_size + name_size + extra_size + comment_size;
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef ZIP_H
+#define ZIP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// An error while reading a zip archive
+struct zip_error : std::exception {
+  virtual ~zip_error() noexcept {
+  }
+
+  virtual const char *what() const noexcept {
+    return "zip error";
+  }
+};
+
+// A file stored in a zip archive
+struct zip_entry {
+  std::string name;
+  std::uint16_t method;
+  std::uint32_t crc;
+  std::size_t compressed_size;
+  std::size_t size;
+  std::size_t header_offset; // The offset of the local file header
+};
+
+// A read-only zip archive mapped into memory
+//
+// The central directory is indexed once when the archive is opened.  Entries
+// are decompressed on demand, and extraction may be called concurrently from
+// multiple threads.
+class zip_archive {
+public:
+  typedef std::vector< zip_entry >::size_type size_type;
+
+  explicit zip_archive(const char *path);
+
+  zip_archive(const zip_archive &) = delete;
+  zip_archive &operator=(const zip_archive &) = delete;
+
+  // Return all file entries in central directory order.
+  const std::vector< zip_entry > &entries() const {
+    return entries_;
+  }
+
+  // Find an entry by name, returning null if it does not exist.
+  const zip_entry *find(const std::string &name) const;
+
+  // Decompress an entry into a buffer.
+  void extract(const zip_entry &entry, std::vector< char > &data) const;
+
+private:
+  void index();
+
+  mapped_file file;
+
+  std::vector< zip_entry > entries_;
+  std::map< std::string, size_type > names;
+};
+
+#endif